@@ -0,0 +1,61 @@
+#include "alloccount.hpp"
+#include <atomic>
+#include <cerrno>
+
+// glibc's own allocator entry points. Defining malloc and friends here replaces them for the whole process, GStreamer
+// and GLib included, so every heap allocation is counted before it is forwarded.
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void *__libc_valloc(size_t size);
+void *__libc_pvalloc(size_t size);
+void __libc_free(void *ptr);
+}
+
+static std::atomic<size_t> allocations(0);
+
+extern "C" {
+void *malloc(size_t size) noexcept {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+void *calloc(size_t count, size_t size) noexcept {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_calloc(count, size);
+}
+void *realloc(void *ptr, size_t size) noexcept {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_realloc(ptr, size);
+}
+void *memalign(size_t alignment, size_t size) noexcept {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_memalign(alignment, size);
+}
+void *aligned_alloc(size_t alignment, size_t size) noexcept {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_memalign(alignment, size);
+}
+int posix_memalign(void **ptr, size_t alignment, size_t size) noexcept {
+  if (alignment % sizeof(void *) || (alignment & (alignment - 1)))
+    return EINVAL;
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void *allocated = __libc_memalign(alignment, size);
+  if (!allocated)
+    return ENOMEM;
+  *ptr = allocated;
+  return 0;
+}
+void *valloc(size_t size) noexcept {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_valloc(size);
+}
+void *pvalloc(size_t size) noexcept {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_pvalloc(size);
+}
+void free(void *ptr) noexcept { __libc_free(ptr); }
+}
+
+size_t allocationCount() { return allocations.load(std::memory_order_relaxed); }
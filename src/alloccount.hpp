@@ -0,0 +1,5 @@
+#pragma once
+#include <cstddef>
+
+// Heap allocations made by the whole process since start, only available when built with COUNT_ALLOCATIONS
+size_t allocationCount();
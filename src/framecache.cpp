@@ -0,0 +1,106 @@
+#include "framecache.hpp"
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+
+#include "jpegerror.hpp"
+
+FrameCacheStats frameCacheStats;
+
+bool decodeJpeg(const uint8_t *data, size_t size, int scale, DecodedFormat format, DecodedFrame &frame) {
+  jpeg_decompress_struct cinfo;
+  JpegError error;
+  cinfo.err = jpeg_std_error(&error.mgr);
+  error.mgr.error_exit = jpeg_error_cb;
+  error.mgr.output_message = jpeg_message_cb;
+  if (setjmp(error.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_create_decompress(&cinfo);
+  // libjpeg-turbo falls back to the standard Huffman tables for Motion JPEG frames without DHT
+  jpeg_mem_src(&cinfo, const_cast<unsigned char *>(data), size);
+  jpeg_read_header(&cinfo, TRUE);
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = scale;
+  cinfo.out_color_space = format == DECODED_GRAY ? JCS_GRAYSCALE : format == DECODED_RGB ? JCS_RGB : JCS_YCbCr;
+  cinfo.dct_method = JDCT_IFAST;
+  jpeg_start_decompress(&cinfo);
+  frame.width = cinfo.output_width;
+  frame.height = cinfo.output_height;
+  frame.stride = cinfo.output_width * cinfo.output_components;
+  frame.format = format;
+  frame.pixels.resize((size_t)frame.stride * frame.height);
+  JSAMPROW rows[16];
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JDIMENSION count = std::min<JDIMENSION>(16, cinfo.output_height - cinfo.output_scanline);
+    for (JDIMENSION i = 0; i < count; i++)
+      rows[i] = frame.pixels.data() + (size_t)(cinfo.output_scanline + i) * frame.stride;
+    jpeg_read_scanlines(&cinfo, rows, count);
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return true;
+}
+
+// Decoded versions of one buffer, attached to it as qdata and freed with it. Pooled camera buffers keep their qdata
+// when they are reused for a new frame, so the cache remembers which frame it belongs to.
+struct FrameCache {
+  std::mutex mutex;
+  GstClockTime pts = GST_CLOCK_TIME_NONE;
+  guint64 offset = GST_BUFFER_OFFSET_NONE;
+  GstMemory *memory = NULL;
+  // by scale and format, a NULL entry remembers that decoding failed
+  std::map<int, std::shared_ptr<const DecodedFrame>> frames;
+};
+
+static void frame_cache_free(gpointer data) { delete static_cast<FrameCache *>(data); }
+
+std::shared_ptr<const DecodedFrame> getDecodedFrame(GstBuffer *buffer, int scale, DecodedFormat format) {
+  static GQuark quark = g_quark_from_static_string("cam2rtpfile-decoded-frame");
+  // only guards attaching the cache, decoding holds the lock of the buffer's own cache
+  static std::mutex attachMutex;
+  FrameCache *cache;
+  {
+    std::lock_guard<std::mutex> lock(attachMutex);
+    cache = static_cast<FrameCache *>(gst_mini_object_get_qdata(GST_MINI_OBJECT(buffer), quark));
+    if (!cache) {
+      cache = new FrameCache();
+      gst_mini_object_set_qdata(GST_MINI_OBJECT(buffer), quark, cache, frame_cache_free);
+    }
+  }
+  // consumers asking while the frame is decoded wait for that decode instead of starting their own
+  std::lock_guard<std::mutex> lock(cache->mutex);
+  GstMemory *memory = gst_buffer_n_memory(buffer) ? gst_buffer_peek_memory(buffer, 0) : NULL;
+  if (cache->pts != GST_BUFFER_PTS(buffer) || cache->offset != GST_BUFFER_OFFSET(buffer) || cache->memory != memory) {
+    cache->frames.clear();
+    cache->pts = GST_BUFFER_PTS(buffer);
+    cache->offset = GST_BUFFER_OFFSET(buffer);
+    cache->memory = memory;
+  }
+  int key = scale * 3 + format;
+  auto cached = cache->frames.find(key);
+  if (cached != cache->frames.end()) {
+    frameCacheStats.hits++;
+    return cached->second;
+  }
+  std::shared_ptr<DecodedFrame> frame = std::make_shared<DecodedFrame>();
+  GstMapInfo map;
+  auto start = std::chrono::steady_clock::now();
+  bool decoded = false;
+  if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+    decoded = decodeJpeg(map.data, map.size, scale, format, *frame);
+    gst_buffer_unmap(buffer, &map);
+  }
+  frameCacheStats.decodeNs +=
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  if (decoded) {
+    frameCacheStats.decodes++;
+  } else {
+    frameCacheStats.failures++;
+    frame = NULL;
+  }
+  cache->frames[key] = frame;
+  return frame;
+}
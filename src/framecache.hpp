@@ -0,0 +1,37 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <gst/gst.h>
+#include <memory>
+#include <vector>
+
+// YCbCr is the JPEG's own color space, it skips the color conversion when the frame is only re-encoded
+enum DecodedFormat { DECODED_GRAY, DECODED_RGB, DECODED_YCBCR };
+
+// Pixels of a decoded frame, rows are stride bytes apart
+struct DecodedFrame {
+  int width = 0;
+  int height = 0;
+  int stride = 0;
+  DecodedFormat format = DECODED_RGB;
+  std::vector<uint8_t> pixels;
+};
+
+// Decodes a JPEG at 1/scale of its size, scale is 1, 2, 4 or 8. The scaling is done by libjpeg in the DCT domain,
+// so smaller scales are also cheaper to decode.
+bool decodeJpeg(const uint8_t *data, size_t size, int scale, DecodedFormat format, DecodedFrame &frame);
+
+// The frame in buffer decoded at 1/scale. Buffers leaving the tee are shared by every branch, the first consumer that
+// asks decodes the frame and attaches the result to the buffer, later consumers asking for the same scale and
+// format get the same pixels. Nothing is decoded unless someone asks. Returns NULL if the frame can not be decoded.
+std::shared_ptr<const DecodedFrame> getDecodedFrame(GstBuffer *buffer, int scale, DecodedFormat format);
+
+// Decodes done by getDecodedFrame, requests answered from the cache, and the total decode time
+struct FrameCacheStats {
+  std::atomic<guint64> decodes{0};
+  std::atomic<guint64> hits{0};
+  std::atomic<guint64> failures{0};
+  std::atomic<guint64> decodeNs{0};
+};
+extern FrameCacheStats frameCacheStats;
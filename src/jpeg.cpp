@@ -0,0 +1,108 @@
+#include "jpeg.hpp"
+#include <cstdio>
+#include <fstream>
+
+// Standard Huffman tables from ITU T.81 Annex K.3, as used by the AVI1 Motion JPEG format
+static const uint8_t STANDARD_DHT[] = {
+    0xFF, 0xC4, 0x01, 0xA2,
+    // luminance DC
+    0x00, 0x00, 0x01, 0x05, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+    0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B,
+    // chrominance DC
+    0x01, 0x00, 0x03, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+    0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B,
+    // luminance AC
+    0x10, 0x00, 0x02, 0x01, 0x03, 0x03, 0x02, 0x04, 0x03, 0x05, 0x05, 0x04, 0x04, 0x00, 0x00, 0x01, 0x7D, 0x01, 0x02,
+    0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81,
+    0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16,
+    0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44,
+    0x45, 0x46, 0x47, 0x48, 0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67,
+    0x68, 0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8A,
+    0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2,
+    0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3,
+    0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2,
+    0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA,
+    // chrominance AC
+    0x11, 0x00, 0x02, 0x01, 0x02, 0x04, 0x04, 0x03, 0x04, 0x07, 0x05, 0x04, 0x04, 0x00, 0x01, 0x02, 0x77, 0x00, 0x01,
+    0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08,
+    0x14, 0x42, 0x91, 0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33, 0x52, 0xF0, 0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34,
+    0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19, 0x1A, 0x26, 0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43,
+    0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66,
+    0x67, 0x68, 0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88,
+    0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9,
+    0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA,
+    0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF2,
+    0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA};
+
+bool parseJpegHeaders(const uint8_t *data, size_t size, std::vector<JpegSegment> &segments) {
+  segments.clear();
+  if (size < 4 || data[0] != 0xFF || data[1] != JPEG_SOI)
+    return false;
+  size_t pos = 2;
+  while (pos + 1 < size) {
+    if (data[pos] != 0xFF)
+      return false;
+    // any number of 0xFF fill bytes may precede a marker
+    size_t start = pos;
+    while (pos < size && data[pos] == 0xFF)
+      pos++;
+    if (pos + 2 >= size)
+      return false;
+    uint8_t marker = data[pos];
+    // restart markers and TEM stand alone, everything else in the header carries a length
+    if ((marker >= 0xD0 && marker <= 0xD7) || marker == 0x01) {
+      pos++;
+      continue;
+    }
+    if (marker == JPEG_SOI || marker == JPEG_EOI || marker == 0x00)
+      return false;
+    size_t length = (data[pos + 1] << 8) | data[pos + 2];
+    if (length < 2 || pos + 1 + length > size)
+      return false;
+    pos += 1 + length;
+    segments.push_back({marker, start, pos - start});
+    if (marker == JPEG_SOS)
+      return true;
+  }
+  return false;
+}
+
+JpegFrameStatus validateJpegFrame(const uint8_t *data, size_t size) {
+  if (size < 4 || data[0] != 0xFF || data[1] != JPEG_SOI)
+    return JPEG_FRAME_NO_SOI;
+  std::vector<JpegSegment> segments;
+  if (!parseJpegHeaders(data, size, segments))
+    return JPEG_FRAME_BAD_HEADER;
+  size_t end = size;
+  while (end > 0 && data[end - 1] == 0x00)
+    end--;
+  auto const &sos = segments.back();
+  if (end < sos.offset + sos.length + 2 || data[end - 2] != 0xFF || data[end - 1] != JPEG_EOI)
+    return JPEG_FRAME_TRUNCATED;
+  return JPEG_FRAME_OK;
+}
+
+bool writeJpegFile(const std::string &filename, const uint8_t *data, size_t size) {
+  std::vector<JpegSegment> segments;
+  if (!parseJpegHeaders(data, size, segments))
+    return false;
+  bool hasDht = false;
+  for (auto const &segment : segments)
+    hasDht |= segment.marker == JPEG_DHT;
+
+  std::string tmpFilename = filename + ".tmp";
+  std::ofstream file(tmpFilename, std::ios::binary | std::ios::trunc);
+  if (!file.good())
+    return false;
+  size_t sosOffset = segments.back().offset;
+  file.write((const char *)data, sosOffset);
+  if (!hasDht)
+    file.write((const char *)STANDARD_DHT, sizeof(STANDARD_DHT));
+  file.write((const char *)data + sosOffset, size - sosOffset);
+  file.close();
+  if (!file.good() || std::rename(tmpFilename.c_str(), filename.c_str()) != 0) {
+    std::remove(tmpFilename.c_str());
+    return false;
+  }
+  return true;
+}
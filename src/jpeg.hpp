@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// JPEG marker codes, the byte following 0xFF
+const uint8_t JPEG_SOF0 = 0xC0;
+const uint8_t JPEG_DHT = 0xC4;
+const uint8_t JPEG_SOI = 0xD8;
+const uint8_t JPEG_EOI = 0xD9;
+const uint8_t JPEG_SOS = 0xDA;
+const uint8_t JPEG_DQT = 0xDB;
+const uint8_t JPEG_DRI = 0xDD;
+
+// A marker segment inside a JPEG frame
+struct JpegSegment {
+  uint8_t marker;
+  size_t offset; // offset of the 0xFF introducing the marker
+  size_t length; // length of the whole segment, including the marker
+};
+
+// Walks the marker segments from SOI up to and including SOS. Returns false if the header structure is broken or the
+// frame ends before the scan starts.
+bool parseJpegHeaders(const uint8_t *data, size_t size, std::vector<JpegSegment> &segments);
+
+// Result of validating a captured frame
+enum JpegFrameStatus { JPEG_FRAME_OK, JPEG_FRAME_NO_SOI, JPEG_FRAME_BAD_HEADER, JPEG_FRAME_TRUNCATED };
+const char *const JPEG_FRAME_STATUS_NAMES[] = {"ok", "no_soi", "bad_header", "truncated"};
+
+// Checks the structure of a frame: SOI at the start, a consistent header up to SOS and EOI at the end, allowing the
+// zero padding some drivers add after it. The entropy coded data is not decoded, so this costs the header walk plus
+// skipping the padding.
+JpegFrameStatus validateJpegFrame(const uint8_t *data, size_t size);
+
+// Writes a frame as a standalone JPEG file. Motion JPEG from UVC cameras usually leaves out the Huffman tables, in
+// that case the standard tables are inserted so every viewer can decode the file. The file is written under a
+// temporary name and renamed, so readers never see a partial image.
+bool writeJpegFile(const std::string &filename, const uint8_t *data, size_t size);
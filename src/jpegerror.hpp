@@ -0,0 +1,18 @@
+#pragma once
+#include <csetjmp>
+#include <cstddef>
+#include <cstdio>
+// jpeglib.h needs size_t and FILE declared first
+#include <jpeglib.h>
+
+// Error handling shared by the libjpeg users. libjpeg reports errors by calling error_exit, which must not return,
+// so jpeg_error_cb jumps back to a setjmp on JpegError::jump.
+struct JpegError {
+  jpeg_error_mgr mgr;
+  jmp_buf jump;
+};
+
+inline void jpeg_error_cb(j_common_ptr cinfo) { longjmp(reinterpret_cast<JpegError *>(cinfo->err)->jump, 1); }
+
+// corrupt data warnings are expected from cameras and would flood the log
+inline void jpeg_message_cb(j_common_ptr cinfo) {}
@@ -0,0 +1,313 @@
+#include "jpegpay.hpp"
+#include "jpeg.hpp"
+#include <algorithm>
+#include <cstring>
+#include <gst/rtp/rtp.h>
+#include <string>
+#include <vector>
+
+// frames between full quantization table resends, for receivers which joined after the tables were sent
+static const guint TABLE_RESEND_INTERVAL = 30;
+// RFC 2435 headers
+static const size_t RTP_HEADER_SIZE = 12;
+static const size_t JPEG_HEADER_SIZE = 8;
+static const size_t RESTART_HEADER_SIZE = 4;
+static const size_t QTABLE_HEADER_SIZE = 4;
+
+// Everything taken from the frame header, valid as long as the header bytes do not change
+struct JpegPayState {
+  // header bytes of the last parsed frame, up to and including SOS
+  std::vector<uint8_t> header;
+  guint8 type = 0;
+  guint16 restartInterval = 0;
+  guint width = 0;
+  guint height = 0;
+  // luminance and chrominance tables in RTP/JPEG order, bit n of precision is set if table n has 16 bit entries
+  std::vector<uint8_t> qtables;
+  guint8 precision = 0;
+  // Q values 128-254 announce static in-band tables, a new value is used whenever the tables change so a receiver
+  // never applies stale tables it cached for the old value
+  guint8 q = 127;
+  guint framesSinceTables = 0;
+  bool sendTables = true;
+  GstBufferPool *pool = NULL;
+};
+
+typedef struct {
+  GstRTPBasePayload parent;
+  JpegPayState *state;
+} NativeJpegPay;
+
+typedef struct {
+  GstRTPBasePayloadClass parent_class;
+} NativeJpegPayClass;
+
+G_DEFINE_TYPE(NativeJpegPay, native_jpeg_pay, GST_TYPE_RTP_BASE_PAYLOAD)
+
+static GstStaticPadTemplate sink_template =
+    GST_STATIC_PAD_TEMPLATE("sink", GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS("image/jpeg"));
+
+static GstStaticPadTemplate src_template =
+    GST_STATIC_PAD_TEMPLATE("src", GST_PAD_SRC, GST_PAD_ALWAYS,
+                            GST_STATIC_CAPS("application/x-rtp, media = (string) video, payload = (int) 26, "
+                                            "clock-rate = (int) 90000, encoding-name = (string) JPEG"));
+
+static guint16 readUint16(const uint8_t *data) { return (data[0] << 8) | data[1]; }
+
+// Parse the header of a frame into the state, the quantization tables are compared with the previous ones
+static bool cacheHeader(JpegPayState *state, const uint8_t *data, size_t size) {
+  std::vector<JpegSegment> segments;
+  if (!parseJpegHeaders(data, size, segments))
+    return false;
+  std::vector<uint8_t> tables[4];
+  bool haveFrame = false;
+  guint8 lumaTable = 0, chromaTable = 0;
+  state->restartInterval = 0;
+  for (auto const &segment : segments) {
+    // skip fill bytes to the marker, the body follows the two length bytes
+    const uint8_t *marker = data + segment.offset;
+    while (*marker == 0xFF)
+      marker++;
+    const uint8_t *body = marker + 3;
+    size_t length = readUint16(marker + 1) - 2;
+    switch (segment.marker) {
+    case JPEG_DQT:
+      for (size_t i = 0; i < length;) {
+        size_t entries = (body[i] >> 4) ? 128 : 64;
+        guint8 id = body[i] & 0x0F;
+        if (id > 3 || i + 1 + entries > length)
+          return false;
+        tables[id].assign(body + i + 1, body + i + 1 + entries);
+        i += 1 + entries;
+      }
+      break;
+    case JPEG_SOF0:
+    case JPEG_SOF0 + 1: {
+      // RFC 2435 only covers YUV with 2x1 or 2x2 luminance and 1x1 chrominance sampling
+      if (length < 15 || body[5] != 3 || body[10] != 0x11 || body[13] != 0x11 || body[11] != body[14])
+        return false;
+      if (body[7] == 0x21)
+        state->type = 0;
+      else if (body[7] == 0x22)
+        state->type = 1;
+      else
+        return false;
+      state->height = readUint16(body + 1);
+      state->width = readUint16(body + 3);
+      lumaTable = body[8] & 0x03;
+      chromaTable = body[11] & 0x03;
+      haveFrame = true;
+      break;
+    }
+    case JPEG_DRI:
+      if (length >= 2)
+        state->restartInterval = readUint16(body);
+      break;
+    default:
+      break;
+    }
+  }
+  if (!haveFrame || tables[lumaTable].empty() || tables[chromaTable].empty())
+    return false;
+  std::vector<uint8_t> qtables(tables[lumaTable]);
+  qtables.insert(qtables.end(), tables[chromaTable].begin(), tables[chromaTable].end());
+  state->precision = (tables[lumaTable].size() == 128 ? 1 : 0) | (tables[chromaTable].size() == 128 ? 2 : 0);
+  if (qtables != state->qtables) {
+    state->qtables = qtables;
+    state->q = state->q >= 254 ? 128 : state->q + 1;
+    state->sendTables = true;
+  }
+  auto const &sos = segments.back();
+  state->header.assign(data, data + sos.offset + sos.length);
+  return true;
+}
+
+static gboolean native_jpeg_pay_set_caps(GstRTPBasePayload *payload, GstCaps *caps) {
+  auto self = (NativeJpegPay *)payload;
+  GstStructure *structure = gst_caps_get_structure(caps, 0);
+  gint width = 0, height = 0;
+  gst_structure_get_int(structure, "width", &width);
+  gst_structure_get_int(structure, "height", &height);
+  gst_rtp_base_payload_set_options(payload, "video", FALSE, "JPEG", 90000);
+  gboolean res;
+  // the JPEG header can only describe up to 2040 pixels, larger frames are announced in the caps
+  if (width > 2040 || height > 2040) {
+    std::string dimensions = std::to_string(width) + "," + std::to_string(height);
+    res = gst_rtp_base_payload_set_outcaps(payload, "x-dimensions", G_TYPE_STRING, dimensions.c_str(), NULL);
+  } else {
+    res = gst_rtp_base_payload_set_outcaps(payload, NULL);
+  }
+  if (!res)
+    return FALSE;
+
+  // take packet buffers from the pool downstream offers, if its buffers can hold a whole packet
+  if (self->state->pool) {
+    gst_object_unref(self->state->pool);
+    self->state->pool = NULL;
+  }
+  GstCaps *outcaps = gst_pad_get_current_caps(GST_RTP_BASE_PAYLOAD_SRCPAD(payload));
+  GstQuery *query = gst_query_new_allocation(outcaps, TRUE);
+  if (gst_pad_peer_query(GST_RTP_BASE_PAYLOAD_SRCPAD(payload), query) &&
+      gst_query_get_n_allocation_pools(query) > 0) {
+    GstBufferPool *pool = NULL;
+    guint size, min, max;
+    gst_query_parse_nth_allocation_pool(query, 0, &pool, &size, &min, &max);
+    if (pool && size >= GST_RTP_BASE_PAYLOAD_MTU(payload) && gst_buffer_pool_is_active(pool))
+      self->state->pool = pool;
+    else if (pool)
+      gst_object_unref(pool);
+  }
+  gst_query_unref(query);
+  if (outcaps)
+    gst_caps_unref(outcaps);
+  return TRUE;
+}
+
+static GstBuffer *allocatePacket(JpegPayState *state, guint size) {
+  GstBuffer *packet = NULL;
+  if (state->pool && gst_buffer_pool_acquire_buffer(state->pool, &packet, NULL) == GST_FLOW_OK)
+    return packet;
+  return gst_buffer_new_allocate(NULL, size, NULL);
+}
+
+static GstFlowReturn native_jpeg_pay_handle_buffer(GstRTPBasePayload *payload, GstBuffer *buffer) {
+  auto state = ((NativeJpegPay *)payload)->state;
+  GstMapInfo map;
+  if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+    gst_buffer_unref(buffer);
+    return GST_FLOW_ERROR;
+  }
+  const uint8_t *data = map.data;
+  size_t size = map.size;
+
+  // cameras repeat the same header on every frame, a single compare replaces parsing it again
+  bool cached = !state->header.empty() && size > state->header.size() &&
+                memcmp(data, state->header.data(), state->header.size()) == 0;
+  if (!cached && !cacheHeader(state, data, size)) {
+    GST_ELEMENT_WARNING(payload, STREAM, FORMAT, ("Invalid or unsupported JPEG frame"), (NULL));
+    state->header.clear();
+    gst_buffer_unmap(buffer, &map);
+    gst_buffer_unref(buffer);
+    return GST_FLOW_OK;
+  }
+
+  // the scan data follows the header, without EOI and any padding after it
+  const uint8_t *scan = data + state->header.size();
+  size_t scanSize = size - state->header.size();
+  while (scanSize >= 2 && !(scan[scanSize - 2] == 0xFF && scan[scanSize - 1] == JPEG_EOI))
+    scanSize--;
+  if (scanSize >= 2)
+    scanSize -= 2;
+  else
+    scanSize = size - state->header.size();
+
+  bool sendTables = state->sendTables || ++state->framesSinceTables >= TABLE_RESEND_INTERVAL;
+  if (sendTables) {
+    state->sendTables = false;
+    state->framesSinceTables = 0;
+  }
+  guint8 type = state->type | (state->restartInterval ? 64 : 0);
+  guint8 width = state->width > 2040 ? 0 : state->width / 8;
+  guint8 height = state->height > 2040 ? 0 : state->height / 8;
+  guint mtu = GST_RTP_BASE_PAYLOAD_MTU(payload);
+
+  GstBufferList *list = gst_buffer_list_new_sized(scanSize / (mtu - RTP_HEADER_SIZE - JPEG_HEADER_SIZE) + 1);
+  size_t offset = 0;
+  while (offset < scanSize) {
+    size_t headerSize = RTP_HEADER_SIZE + JPEG_HEADER_SIZE + (state->restartInterval ? RESTART_HEADER_SIZE : 0);
+    size_t tablesSize = sendTables ? state->qtables.size() : 0;
+    if (offset == 0)
+      headerSize += QTABLE_HEADER_SIZE + tablesSize;
+    size_t chunk = std::min(scanSize - offset, (size_t)mtu - headerSize);
+    bool last = offset + chunk == scanSize;
+
+    GstBuffer *packet = allocatePacket(state, mtu);
+    GstMapInfo out;
+    gst_buffer_map(packet, &out, GST_MAP_WRITE);
+    uint8_t *p = out.data;
+    // RTP header, sequence number, timestamp and SSRC are filled in by the base class when pushing
+    memset(p, 0, RTP_HEADER_SIZE);
+    p[0] = 0x80;
+    p[1] = (last ? 0x80 : 0) | GST_RTP_BASE_PAYLOAD_PT(payload);
+    p += RTP_HEADER_SIZE;
+    // main JPEG header
+    *p++ = 0;
+    *p++ = offset >> 16;
+    *p++ = offset >> 8;
+    *p++ = offset;
+    *p++ = type;
+    *p++ = state->q;
+    *p++ = width;
+    *p++ = height;
+    if (state->restartInterval) {
+      // the fragments are not aligned to restart intervals, so every packet covers the whole frame
+      *p++ = state->restartInterval >> 8;
+      *p++ = state->restartInterval;
+      *p++ = 0xFF;
+      *p++ = 0xFF;
+    }
+    if (offset == 0) {
+      // a zero length tells the receiver to reuse the tables it has for this Q value
+      *p++ = 0;
+      *p++ = state->precision;
+      *p++ = tablesSize >> 8;
+      *p++ = tablesSize;
+      if (tablesSize) {
+        memcpy(p, state->qtables.data(), tablesSize);
+        p += tablesSize;
+      }
+    }
+    memcpy(p, scan + offset, chunk);
+    gst_buffer_unmap(packet, &out);
+    gst_buffer_set_size(packet, headerSize + chunk);
+    GST_BUFFER_PTS(packet) = GST_BUFFER_PTS(buffer);
+    gst_buffer_list_add(list, packet);
+    offset += chunk;
+  }
+
+  gst_buffer_unmap(buffer, &map);
+  gst_buffer_unref(buffer);
+  return gst_rtp_base_payload_push_list(payload, list);
+}
+
+static GstStateChangeReturn native_jpeg_pay_change_state(GstElement *element, GstStateChange transition) {
+  auto state = ((NativeJpegPay *)element)->state;
+  if (transition == GST_STATE_CHANGE_READY_TO_PAUSED) {
+    // a restarted stream may have new receivers, so start with full tables again
+    state->header.clear();
+    state->sendTables = true;
+  }
+  return GST_ELEMENT_CLASS(native_jpeg_pay_parent_class)->change_state(element, transition);
+}
+
+static void native_jpeg_pay_finalize(GObject *object) {
+  auto self = (NativeJpegPay *)object;
+  if (self->state->pool)
+    gst_object_unref(self->state->pool);
+  delete self->state;
+  G_OBJECT_CLASS(native_jpeg_pay_parent_class)->finalize(object);
+}
+
+static void native_jpeg_pay_class_init(NativeJpegPayClass *klass) {
+  GObjectClass *gobjectClass = G_OBJECT_CLASS(klass);
+  GstElementClass *elementClass = GST_ELEMENT_CLASS(klass);
+  GstRTPBasePayloadClass *payloadClass = GST_RTP_BASE_PAYLOAD_CLASS(klass);
+  gobjectClass->finalize = native_jpeg_pay_finalize;
+  elementClass->change_state = native_jpeg_pay_change_state;
+  payloadClass->set_caps = native_jpeg_pay_set_caps;
+  payloadClass->handle_buffer = native_jpeg_pay_handle_buffer;
+  gst_element_class_add_static_pad_template(elementClass, &sink_template);
+  gst_element_class_add_static_pad_template(elementClass, &src_template);
+  gst_element_class_set_static_metadata(elementClass, "Native RTP JPEG payloader", "Codec/Payloader/Network/RTP",
+                                        "Payload camera JPEG frames into RTP packets (RFC 2435) with cached headers",
+                                        "cam2rtpfile");
+}
+
+static void native_jpeg_pay_init(NativeJpegPay *self) {
+  self->state = new JpegPayState();
+  GST_RTP_BASE_PAYLOAD_PT(self) = GST_RTP_PAYLOAD_JPEG;
+}
+
+gboolean registerNativeJpegPay() {
+  return gst_element_register(NULL, "nativejpegpay", GST_RANK_NONE, native_jpeg_pay_get_type());
+}
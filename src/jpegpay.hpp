@@ -0,0 +1,9 @@
+#pragma once
+#include <gst/gst.h>
+
+// RTP/JPEG (RFC 2435) payloader for the fixed caps camera path, registered as "nativejpegpay". The header of every
+// frame is compared against the one parsed from the previous frame, while the camera keeps sending the same
+// header nothing is parsed again. Packets are written directly into buffers from the pool negotiated through the
+// allocation query, and quantization tables are only sent in full when they change and once a second for receivers
+// joining late.
+gboolean registerNativeJpegPay();
@@ -0,0 +1,73 @@
+#include "packetpool.hpp"
+
+// cache line size of the Jetson's Cortex-A57, as an alignment mask
+static const gsize PACKET_ALIGN = 63;
+
+PacketPool::~PacketPool() {
+  if (pool) {
+    gst_buffer_pool_set_active(pool, FALSE);
+    gst_object_unref(pool);
+  }
+}
+
+bool PacketPool::init(guint size, guint preallocate) {
+  packetSize = size;
+  preallocated = preallocate;
+  pool = gst_buffer_pool_new();
+  GstStructure *config = gst_buffer_pool_get_config(pool);
+  GstAllocationParams params;
+  gst_allocation_params_init(&params);
+  params.align = PACKET_ALIGN;
+  // no maximum, a burst grows the pool once and the extra buffers are reused afterwards
+  gst_buffer_pool_config_set_params(config, NULL, size, preallocate, 0);
+  gst_buffer_pool_config_set_allocator(config, NULL, &params);
+  if (!gst_buffer_pool_set_config(pool, config) || !gst_buffer_pool_set_active(pool, TRUE)) {
+    g_printerr("Could not allocate the packet pool\n");
+    gst_object_unref(pool);
+    pool = NULL;
+    return false;
+  }
+  return true;
+}
+
+void PacketPool::offer(GstPad *pad) {
+  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM, allocation_cb, this, NULL);
+}
+
+void PacketPool::watch(GstPad *pad) {
+  gst_pad_add_probe(pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST), count_cb,
+                    this, NULL);
+}
+
+void PacketPool::count(GstBuffer *packet) {
+  if (pool && packet->pool == pool)
+    pooled++;
+  else
+    unpooled++;
+}
+
+// The pool is already active and preallocated, the payloader takes buffers from it as configured
+GstPadProbeReturn PacketPool::allocation_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  auto self = static_cast<PacketPool *>(user_data);
+  GstQuery *query = GST_PAD_PROBE_INFO_QUERY(info);
+  if (GST_QUERY_TYPE(query) != GST_QUERY_ALLOCATION || !self->pool)
+    return GST_PAD_PROBE_OK;
+  GstAllocationParams params;
+  gst_allocation_params_init(&params);
+  params.align = PACKET_ALIGN;
+  gst_query_add_allocation_param(query, NULL, &params);
+  gst_query_add_allocation_pool(query, self->pool, self->packetSize, self->preallocated, 0);
+  return GST_PAD_PROBE_HANDLED;
+}
+
+GstPadProbeReturn PacketPool::count_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  auto self = static_cast<PacketPool *>(user_data);
+  if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+    for (guint i = 0; i < gst_buffer_list_length(list); i++)
+      self->count(gst_buffer_list_get(list, i));
+  } else {
+    self->count(GST_PAD_PROBE_INFO_BUFFER(info));
+  }
+  return GST_PAD_PROBE_OK;
+}
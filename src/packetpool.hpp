@@ -0,0 +1,32 @@
+#pragma once
+#include <atomic>
+#include <gst/gst.h>
+
+// Preallocated MTU sized packet buffers, aligned to cache lines, which return to the pool once the sink has sent
+// them. The pool is offered through the allocation query of the network branch, a payloader which allocates its
+// packets from the negotiated pool does no heap allocation per packet in steady state. The native payloader does,
+// the stock rtpjpegpay always allocates its own packets and shows up as unpooled.
+class PacketPool {
+public:
+  // packets leaving the network branch, by whether their buffer came from the pool
+  std::atomic<guint64> pooled{0};
+  std::atomic<guint64> unpooled{0};
+
+  ~PacketPool();
+  bool init(guint size, guint preallocate);
+  // answer the allocation queries arriving at pad with the pool
+  void offer(GstPad *pad);
+  // count the packets passing pad
+  void watch(GstPad *pad);
+  GstBufferPool *get() { return pool; }
+  guint size() { return packetSize; }
+
+private:
+  GstBufferPool *pool = NULL;
+  guint packetSize = 0;
+  guint preallocated = 0;
+
+  void count(GstBuffer *packet);
+  static GstPadProbeReturn allocation_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+  static GstPadProbeReturn count_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+};
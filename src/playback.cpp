@@ -0,0 +1,171 @@
+#include "playback.hpp"
+
+int RecordingPlayback::init(const std::string &file, const char *payloader, std::function<void()> finished) {
+  if (!g_file_test(file.c_str(), G_FILE_TEST_IS_REGULAR)) {
+    g_printerr("Recording %s not found\n", file.c_str());
+    return -1;
+  }
+  this->file = file;
+  this->finished = finished;
+  pipeline = gst_pipeline_new("playback");
+  GstElement *src = gst_element_factory_make("filesrc", "playbackSrc");
+  GstElement *demux = gst_element_factory_make("matroskademux", "playbackDemux");
+  pay = gst_element_factory_make(payloader, "playbackPay");
+  udpSink = gst_element_factory_make("multiudpsink", "playbackUdpSink");
+  if (!pipeline || !src || !demux || !pay || !udpSink) {
+    g_printerr("Could not create the playback elements\n");
+    stop();
+    return -1;
+  }
+  gst_bin_add_many(GST_BIN(pipeline), src, demux, pay, udpSink, NULL);
+  if (!gst_element_link(src, demux) || !gst_element_link(pay, udpSink)) {
+    g_printerr("Failed to link playback\n");
+    stop();
+    return -1;
+  }
+  g_object_set(G_OBJECT(src), "location", file.c_str(), NULL);
+  g_signal_connect(demux, "pad-added", G_CALLBACK(pad_added_cb), this);
+  GstPad *payPad = gst_element_get_static_pad(pay, "sink");
+  gst_pad_add_probe(payPad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_FLUSH), buffer_cb,
+                    this, NULL);
+  gst_object_unref(payPad);
+  GstBus *bus = gst_element_get_bus(pipeline);
+  watch = gst_bus_add_watch(bus, bus_cb, this);
+  gst_object_unref(bus);
+  return 0;
+}
+
+void RecordingPlayback::start(double startSeconds, double speed) {
+  std::lock_guard<std::mutex> lock(mutex);
+  this->startSeconds = startSeconds;
+  rate = speed;
+  // the udpsink paces frames by their timestamps, which the seek rate scales
+  g_object_set(G_OBJECT(udpSink), "sync", speed > 0, NULL);
+  if (prerolled)
+    seek();
+  else
+    gst_element_set_state(pipeline, GST_STATE_PAUSED);
+}
+
+// called with the mutex held
+void RecordingPlayback::seek() {
+  {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    seekStart = std::chrono::steady_clock::now();
+    flushed = false;
+    seeking = true;
+  }
+  if (!gst_element_seek(pipeline, rate > 0 ? rate : 1.0, GST_FORMAT_TIME,
+                        (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT), GST_SEEK_TYPE_SET,
+                        (gint64)(startSeconds * GST_SECOND), GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE)) {
+    g_printerr("Could not seek %s to %.1f s\n", file.c_str(), startSeconds);
+    std::lock_guard<std::mutex> lock(statsMutex);
+    seeking = false;
+  }
+  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+}
+
+void RecordingPlayback::stop() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (watch)
+    g_source_remove(watch);
+  watch = 0;
+  if (pipeline) {
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+  }
+  pipeline = NULL;
+  pay = NULL;
+  udpSink = NULL;
+  destinations.clear();
+  prerolled = false;
+  frames = 0;
+  bytes = 0;
+  seekMs = -1;
+  std::lock_guard<std::mutex> statsLock(statsMutex);
+  seeking = false;
+  bytesSinceSeek = 0;
+}
+
+double RecordingPlayback::speed() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return rate;
+}
+
+double RecordingPlayback::position() {
+  gint64 position;
+  if (!pipeline || !gst_element_query_position(pipeline, GST_FORMAT_TIME, &position))
+    return -1;
+  return (double)position / GST_SECOND;
+}
+
+double RecordingPlayback::throughputMbps() {
+  std::lock_guard<std::mutex> lock(statsMutex);
+  double seconds = std::chrono::duration<double>(lastBuffer - firstBuffer).count();
+  return seconds > 0 ? bytesSinceSeek * 8 / seconds / 1e6 : 0;
+}
+
+void RecordingPlayback::pad_added_cb(GstElement *element, GstPad *pad, gpointer user_data) {
+  auto self = static_cast<RecordingPlayback *>(user_data);
+  GstPad *payPad = gst_element_get_static_pad(self->pay, "sink");
+  if (!gst_pad_is_linked(payPad) && gst_pad_link(pad, payPad) != GST_PAD_LINK_OK)
+    g_printerr("Could not link the video track of %s\n", self->file.c_str());
+  gst_object_unref(payPad);
+}
+
+GstPadProbeReturn RecordingPlayback::buffer_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  auto self = static_cast<RecordingPlayback *>(user_data);
+  std::lock_guard<std::mutex> lock(self->statsMutex);
+  if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_FLUSH) {
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_FLUSH_STOP)
+      self->flushed = true;
+    return GST_PAD_PROBE_OK;
+  }
+  auto now = std::chrono::steady_clock::now();
+  gsize size = gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER(info));
+  // frames still in flight from before the seek are flushed, the first one after the flush is from the new position
+  if (self->seeking && self->flushed) {
+    self->seeking = false;
+    self->seekMs = std::chrono::duration<double, std::milli>(now - self->seekStart).count();
+    self->firstBuffer = now;
+    self->bytesSinceSeek = 0;
+    g_print("Replay seek to %.1f s took %.1f ms\n", self->startSeconds, self->seekMs.load());
+  }
+  self->lastBuffer = now;
+  self->bytesSinceSeek += size;
+  self->frames++;
+  self->bytes += size;
+  return GST_PAD_PROBE_OK;
+}
+
+gboolean RecordingPlayback::bus_cb(GstBus *bus, GstMessage *message, gpointer user_data) {
+  auto self = static_cast<RecordingPlayback *>(user_data);
+  switch (GST_MESSAGE_TYPE(message)) {
+  case GST_MESSAGE_ASYNC_DONE: {
+    // the first preroll, seeks preroll again but are already running
+    std::lock_guard<std::mutex> lock(self->mutex);
+    if (!self->prerolled) {
+      self->prerolled = true;
+      self->seek();
+    }
+    return G_SOURCE_CONTINUE;
+  }
+  case GST_MESSAGE_ERROR: {
+    GError *err = NULL;
+    gst_message_parse_error(message, &err, NULL);
+    g_printerr("Replay of %s failed: %s\n", self->file.c_str(), err->message);
+    g_error_free(err);
+    break;
+  }
+  case GST_MESSAGE_EOS:
+    g_print("Replay of %s finished\n", self->file.c_str());
+    break;
+  default:
+    return G_SOURCE_CONTINUE;
+  }
+  // the watch goes away with this return, finished stops the pipeline
+  self->watch = 0;
+  if (self->finished)
+    self->finished();
+  return G_SOURCE_REMOVE;
+}
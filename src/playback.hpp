@@ -0,0 +1,63 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <gst/gst.h>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Streams a stored recording over RTP from a pipeline of its own: filesrc -> matroskademux -> payloader ->
+// multiudpsink. Seeks go through matroskademux, which finds the keyframe from the cues at the end of the file
+// instead of scanning the clusters, and playback can run faster than realtime or as fast as the disk allows.
+class RecordingPlayback {
+public:
+  std::string file;
+  GstElement *udpSink = NULL;
+  // addresses currently configured on the udpsink
+  std::vector<std::pair<std::string, int>> destinations;
+  // Frames sent and their bytes, and how long the last seek took until its first frame
+  std::atomic<guint64> frames{0};
+  std::atomic<guint64> bytes{0};
+  std::atomic<double> seekMs{-1};
+
+  // builds the pipeline without starting it, so udpSink can be configured. finished is called on the main loop when
+  // the recording ends or fails
+  int init(const std::string &file, const char *payloader, std::function<void()> finished);
+  // seeks to start seconds and plays at speed times realtime, 0 sends as fast as the file is read. Calling it again
+  // while playing only seeks.
+  void start(double startSeconds, double speed);
+  void stop();
+  bool running() { return pipeline != NULL; }
+  double speed();
+  // position in the recording in seconds, -1 if unknown
+  double position();
+  // average rate frames were read and sent at since the last seek
+  double throughputMbps();
+
+private:
+  GstElement *pipeline = NULL;
+  GstElement *pay = NULL;
+  guint watch = 0;
+  std::function<void()> finished;
+  std::mutex mutex;
+  // a seek has to wait until the pipeline prerolled
+  bool prerolled = false;
+  double startSeconds = 0;
+  double rate = 1;
+  // Seek timing, the first frame after the flush of a seek ends it. Guarded by statsMutex, which the streaming thread
+  // takes, the other mutex is held while seeking and stopping, which wait for the streaming thread.
+  std::mutex statsMutex;
+  std::chrono::steady_clock::time_point seekStart;
+  bool seeking = false;
+  bool flushed = false;
+  std::chrono::steady_clock::time_point firstBuffer;
+  std::chrono::steady_clock::time_point lastBuffer;
+  guint64 bytesSinceSeek = 0;
+
+  void seek();
+  static void pad_added_cb(GstElement *element, GstPad *pad, gpointer user_data);
+  static GstPadProbeReturn buffer_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+  static gboolean bus_cb(GstBus *bus, GstMessage *message, gpointer user_data);
+};
@@ -0,0 +1,302 @@
+#include "recordindex.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <gst/app/app.h>
+#include <initializer_list>
+
+// frames the muxer holds back before writing, anything older was dropped by it
+static const size_t MAX_PENDING_FRAMES = 64;
+// Exports run on the input thread. Writing is faster than real time, so a pipeline that has not finished within the
+// clip's own length on top of this is stalled and given up on.
+static const GstClockTime EXPORT_TIMEOUT = 10 * GST_SECOND;
+
+void RecordIndexWriter::attach(GstElement *recordQueue, GstElement *fileSink) {
+  GstPad *queuePad = gst_element_get_static_pad(recordQueue, "src");
+  gst_pad_add_probe(queuePad, GST_PAD_PROBE_TYPE_BUFFER, frame_cb, this, NULL);
+  gst_object_unref(queuePad);
+  GstPad *sinkPad = gst_element_get_static_pad(fileSink, "sink");
+  gst_pad_add_probe(sinkPad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+                    write_cb, this, NULL);
+  gst_object_unref(sinkPad);
+}
+
+bool RecordIndexWriter::open(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (file)
+    fclose(file);
+  file = fopen(path.c_str(), "wb");
+  if (!file) {
+    g_printerr("Could not create the recording index %s: %s\n", path.c_str(), g_strerror(errno));
+    return false;
+  }
+  headerWritten = false;
+  pending.clear();
+  position = 0;
+  written = 0;
+  return true;
+}
+
+void RecordIndexWriter::close() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (file)
+    fclose(file);
+  file = NULL;
+  pending.clear();
+}
+
+guint64 RecordIndexWriter::frames() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return written;
+}
+
+GstPadProbeReturn RecordIndexWriter::frame_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  auto self = static_cast<RecordIndexWriter *>(user_data);
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+  std::lock_guard<std::mutex> lock(self->mutex);
+  if (!self->file || gst_buffer_n_memory(buffer) != 1 || !GST_BUFFER_PTS_IS_VALID(buffer))
+    return GST_PAD_PROBE_OK;
+  if (!self->headerWritten) {
+    RecordIndexHeader header = {RECORD_INDEX_MAGIC, RECORD_INDEX_VERSION, 0, 0, 0, 1};
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    if (caps) {
+      GstStructure *structure = gst_caps_get_structure(caps, 0);
+      int width = 0, height = 0, num = 0, den = 1;
+      gst_structure_get_int(structure, "width", &width);
+      gst_structure_get_int(structure, "height", &height);
+      gst_structure_get_fraction(structure, "framerate", &num, &den);
+      header.width = width;
+      header.height = height;
+      header.framerateNum = num;
+      header.framerateDen = den;
+      gst_caps_unref(caps);
+    }
+    fwrite(&header, sizeof(header), 1, self->file);
+    self->headerWritten = true;
+    self->firstPts = GST_BUFFER_PTS(buffer);
+  }
+  if (self->pending.size() >= MAX_PENDING_FRAMES)
+    self->pending.pop_front();
+  uint64_t pts = GST_BUFFER_PTS(buffer);
+  self->pending.push_back(
+      {gst_buffer_peek_memory(buffer, 0), pts - std::min(self->firstPts, pts), (uint32_t)gst_buffer_get_size(buffer)});
+  return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn RecordIndexWriter::write_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  auto self = static_cast<RecordIndexWriter *>(user_data);
+  std::lock_guard<std::mutex> lock(self->mutex);
+  if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    // the muxer seeks back to rewrite its headers
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(event) == GST_EVENT_SEGMENT) {
+      const GstSegment *segment;
+      gst_event_parse_segment(event, &segment);
+      if (segment->format == GST_FORMAT_BYTES)
+        self->position = segment->start;
+    }
+    return GST_PAD_PROBE_OK;
+  }
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+  uint64_t offset = self->position;
+  self->position += gst_buffer_get_size(buffer);
+  if (!self->file)
+    return GST_PAD_PROBE_OK;
+  // the frame may arrive on its own or appended to the block header
+  for (guint i = 0; i < gst_buffer_n_memory(buffer); i++) {
+    GstMemory *memory = gst_buffer_peek_memory(buffer, i);
+    gsize size = gst_memory_get_sizes(memory, NULL, NULL);
+    auto frame = std::find_if(self->pending.begin(), self->pending.end(),
+                              [&](const PendingFrame &f) { return f.memory == memory && f.size == size; });
+    if (frame != self->pending.end()) {
+      RecordIndexEntry entry = {frame->pts, offset, frame->size, 0};
+      fwrite(&entry, sizeof(entry), 1, self->file);
+      self->written++;
+      self->pending.erase(self->pending.begin(), frame + 1);
+    }
+    offset += size;
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+static void unrefElements(std::initializer_list<GstElement *> elements) {
+  for (GstElement *element : elements)
+    if (element)
+      gst_object_unref(element);
+}
+
+// the pipeline is stopped whether it finished or not
+static bool waitForEos(GstElement *pipeline, const std::string &output, double seconds) {
+  GstBus *bus = gst_element_get_bus(pipeline);
+  GstMessage *message = gst_bus_timed_pop_filtered(bus, EXPORT_TIMEOUT + (GstClockTime)(seconds * GST_SECOND),
+                                                   (GstMessageType)(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(bus);
+  if (!message) {
+    g_printerr("Could not write %s: timed out\n", output.c_str());
+    return false;
+  }
+  bool ok = GST_MESSAGE_TYPE(message) == GST_MESSAGE_EOS;
+  if (!ok) {
+    GError *err = NULL;
+    gst_message_parse_error(message, &err, NULL);
+    g_printerr("Could not write %s: %s\n", output.c_str(), err->message);
+    g_error_free(err);
+  }
+  gst_message_unref(message);
+  return ok;
+}
+
+bool readRecordIndexHeader(const std::string &file, RecordIndexHeader &header) {
+  FILE *index = fopen((file + ".idx").c_str(), "rb");
+  if (!index)
+    return false;
+  bool ok = fread(&header, sizeof(header), 1, index) == 1;
+  fclose(index);
+  return ok && header.magic == RECORD_INDEX_MAGIC && header.version == RECORD_INDEX_VERSION;
+}
+
+int exportClip(const std::string &file, double t0, double t1, const std::string &output) {
+  GError *error = NULL;
+  GMappedFile *index = g_mapped_file_new((file + ".idx").c_str(), FALSE, &error);
+  if (!index) {
+    g_printerr("Could not map the index of %s: %s\n", file.c_str(), error->message);
+    g_error_free(error);
+    return -1;
+  }
+  GMappedFile *mkv = g_mapped_file_new(file.c_str(), FALSE, &error);
+  if (!mkv) {
+    g_printerr("Could not map %s: %s\n", file.c_str(), error->message);
+    g_error_free(error);
+    g_mapped_file_unref(index);
+    return -1;
+  }
+  const char *contents = g_mapped_file_get_contents(index);
+  gsize length = g_mapped_file_get_length(index);
+  const RecordIndexHeader *header = reinterpret_cast<const RecordIndexHeader *>(contents);
+  if (length < sizeof(RecordIndexHeader) || header->magic != RECORD_INDEX_MAGIC ||
+      header->version != RECORD_INDEX_VERSION) {
+    g_printerr("%s.idx is not a recording index\n", file.c_str());
+    g_mapped_file_unref(index);
+    g_mapped_file_unref(mkv);
+    return -1;
+  }
+  // written when the recording's caps had no size, the frames cannot be muxed without one
+  if (!header->width || !header->height) {
+    g_printerr("%s.idx has no frame size\n", file.c_str());
+    g_mapped_file_unref(index);
+    g_mapped_file_unref(mkv);
+    return -1;
+  }
+  // a recording that is still being written may end in a partial entry
+  auto entries = reinterpret_cast<const RecordIndexEntry *>(contents + sizeof(RecordIndexHeader));
+  auto end = entries + (length - sizeof(RecordIndexHeader)) / sizeof(RecordIndexEntry);
+  auto first = std::lower_bound(entries, end, (uint64_t)(t0 * GST_SECOND),
+                                [](const RecordIndexEntry &e, uint64_t pts) { return e.pts < pts; });
+  auto last = std::upper_bound(first, end, (uint64_t)(t1 * GST_SECOND),
+                               [](uint64_t pts, const RecordIndexEntry &e) { return pts < e.pts; });
+
+  GstElement *pipeline = gst_pipeline_new("export");
+  GstElement *src = gst_element_factory_make("appsrc", NULL);
+  GstElement *mux = gst_element_factory_make("matroskamux", NULL);
+  GstElement *sink = gst_element_factory_make("filesink", NULL);
+  if (!pipeline || !src || !mux || !sink) {
+    g_printerr("Could not create the export elements\n");
+    unrefElements({pipeline, src, mux, sink});
+    g_mapped_file_unref(index);
+    g_mapped_file_unref(mkv);
+    return -1;
+  }
+  gst_bin_add_many(GST_BIN(pipeline), src, mux, sink, NULL);
+  gst_element_link_many(src, mux, sink, NULL);
+  GstCaps *caps = gst_caps_new_simple("image/jpeg", "width", G_TYPE_INT, (int)header->width, "height", G_TYPE_INT,
+                                      (int)header->height, "framerate", GST_TYPE_FRACTION, (int)header->framerateNum,
+                                      (int)header->framerateDen, NULL);
+  // the buffers only wrap the mapping, so the whole clip is queued rather than blocking the input thread on the muxer
+  g_object_set(G_OBJECT(src), "caps", caps, "format", GST_FORMAT_TIME, "max-bytes", (guint64)0, NULL);
+  gst_caps_unref(caps);
+  g_object_set(G_OBJECT(sink), "location", output.c_str(), NULL);
+  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+  int frames = 0;
+  gsize mkvLength = g_mapped_file_get_length(mkv);
+  for (auto entry = first; entry < last; entry++) {
+    if (entry->offset + entry->size > mkvLength)
+      break;
+    // the buffer points into the mapping and keeps it alive
+    GstBuffer *buffer =
+        gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, g_mapped_file_get_contents(mkv), mkvLength,
+                                    entry->offset, entry->size, g_mapped_file_ref(mkv),
+                                    (GDestroyNotify)g_mapped_file_unref);
+    GST_BUFFER_PTS(buffer) = entry->pts - first->pts;
+    if (gst_app_src_push_buffer(GST_APP_SRC(src), buffer) != GST_FLOW_OK)
+      break;
+    frames++;
+  }
+  gst_app_src_end_of_stream(GST_APP_SRC(src));
+  bool ok = waitForEos(pipeline, output, t1 - t0);
+  gst_object_unref(pipeline);
+  g_mapped_file_unref(index);
+  g_mapped_file_unref(mkv);
+  return ok ? frames : -1;
+}
+
+struct RemuxRange {
+  GstClockTime t0;
+  GstClockTime t1;
+  GstClockTime first = GST_CLOCK_TIME_NONE;
+  int frames = 0;
+  bool ended = false;
+};
+
+static GstPadProbeReturn remux_range_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  auto range = static_cast<RemuxRange *>(user_data);
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+  if (!GST_BUFFER_PTS_IS_VALID(buffer))
+    return GST_PAD_PROBE_DROP;
+  if (!GST_CLOCK_TIME_IS_VALID(range->first))
+    range->first = GST_BUFFER_PTS(buffer);
+  GstClockTime pts = GST_BUFFER_PTS(buffer) - range->first;
+  // the rest of the file is not needed, the demuxer stops once the pad is at EOS
+  if (pts > range->t1 && !range->ended) {
+    range->ended = true;
+    gst_pad_push_event(pad, gst_event_new_eos());
+  }
+  if (pts < range->t0 || pts > range->t1)
+    return GST_PAD_PROBE_DROP;
+  range->frames++;
+  return GST_PAD_PROBE_OK;
+}
+
+static void remux_pad_added_cb(GstElement *demux, GstPad *pad, gpointer user_data) {
+  GstElement *mux = static_cast<GstElement *>(user_data);
+  if (gst_element_link_pads(demux, GST_PAD_NAME(pad), mux, NULL))
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, remux_range_cb, g_object_get_data(G_OBJECT(demux), "range"),
+                      NULL);
+}
+
+int remuxClip(const std::string &file, double t0, double t1, const std::string &output) {
+  GstElement *pipeline = gst_pipeline_new("remux");
+  GstElement *src = gst_element_factory_make("filesrc", NULL);
+  GstElement *demux = gst_element_factory_make("matroskademux", NULL);
+  GstElement *mux = gst_element_factory_make("matroskamux", NULL);
+  GstElement *sink = gst_element_factory_make("filesink", NULL);
+  if (!pipeline || !src || !demux || !mux || !sink) {
+    g_printerr("Could not create the remux elements\n");
+    unrefElements({pipeline, src, demux, mux, sink});
+    return -1;
+  }
+  gst_bin_add_many(GST_BIN(pipeline), src, demux, mux, sink, NULL);
+  gst_element_link(src, demux);
+  gst_element_link(mux, sink);
+  RemuxRange range;
+  range.t0 = (GstClockTime)(t0 * GST_SECOND);
+  range.t1 = (GstClockTime)(t1 * GST_SECOND);
+  g_object_set_data(G_OBJECT(demux), "range", &range);
+  g_signal_connect(demux, "pad-added", G_CALLBACK(remux_pad_added_cb), mux);
+  g_object_set(G_OBJECT(src), "location", file.c_str(), NULL);
+  g_object_set(G_OBJECT(sink), "location", output.c_str(), NULL);
+  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+  bool ok = waitForEos(pipeline, output, t1);
+  gst_object_unref(pipeline);
+  return ok ? range.frames : -1;
+}
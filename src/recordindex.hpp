@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <gst/gst.h>
+#include <mutex>
+#include <string>
+
+// Sidecar index of a recording, written next to <name>.mkv as <name>.mkv.idx. A RecordIndexHeader followed by one
+// RecordIndexEntry per frame in file order, all little endian as written by the recorder. It locates the JPEG data of
+// every frame inside the Matroska file, so a clip can be cut by copying the frames in its time range without parsing
+// the clusters before it. Every MJPEG frame is a keyframe, so a clip may start at any entry.
+const uint32_t RECORD_INDEX_MAGIC = 0x58444943; // "CIDX"
+const uint32_t RECORD_INDEX_VERSION = 1;
+
+struct RecordIndexHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+  uint32_t framerateNum;
+  uint32_t framerateDen;
+};
+
+struct RecordIndexEntry {
+  uint64_t pts;    // ns since the first frame of the file
+  uint64_t offset; // of the JPEG data in the .mkv
+  uint32_t size;   // bytes of JPEG data
+  uint32_t reserved;
+};
+
+// Writes the index while recording. Frames are remembered by their memory and size as they enter the muxer, and the
+// byte position at which that memory reaches the filesink is their offset. Frames the muxer copies instead of passing
+// through are left out of the index.
+class RecordIndexWriter {
+public:
+  // watches frames leaving recordQueue and the bytes reaching fileSink
+  void attach(GstElement *recordQueue, GstElement *fileSink);
+  bool open(const std::string &path);
+  void close();
+  guint64 frames();
+
+private:
+  struct PendingFrame {
+    GstMemory *memory;
+    uint64_t pts;
+    uint32_t size;
+  };
+  std::mutex mutex;
+  FILE *file = NULL;
+  bool headerWritten = false;
+  uint64_t firstPts = 0;
+  // frames entered the muxer but not yet seen at the filesink. The memory is only compared, camera buffer pools
+  // reuse it, so the size has to match too.
+  std::deque<PendingFrame> pending;
+  // byte position in the .mkv of the next buffer reaching the filesink
+  uint64_t position = 0;
+  guint64 written = 0;
+
+  static GstPadProbeReturn frame_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+  static GstPadProbeReturn write_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+};
+
+// Reads the header of <file>.idx, false if the recording has no valid index
+bool readRecordIndexHeader(const std::string &file, RecordIndexHeader &header);
+// Cuts the frames from t0 to t1 seconds of a recording into a new .mkv using its index. Both files are memory mapped
+// and the frames are handed to the muxer without copying, so only the pages of the clip are read. Returns the number
+// of frames exported, -1 on failure.
+int exportClip(const std::string &file, double t0, double t1, const std::string &output);
+// The same clip by demuxing the recording from the start and keeping the frames in range, the baseline exportClip is
+// measured against.
+int remuxClip(const std::string &file, double t0, double t1, const std::string &output);
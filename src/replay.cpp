@@ -0,0 +1,160 @@
+#include "replay.hpp"
+#include <algorithm>
+
+ReplaySource::~ReplaySource() {
+  if (file)
+    g_mapped_file_unref(file);
+}
+
+GstElement *ReplaySource::create() {
+  GError *error = NULL;
+  file = g_mapped_file_new(path.c_str(), FALSE, &error);
+  if (!file) {
+    g_printerr("Could not map %s: %s\n", path.c_str(), error->message);
+    g_error_free(error);
+    return NULL;
+  }
+  GstElement *bin = gst_bin_new("videosrc");
+  GstElement *src = gst_element_factory_make("appsrc", "replaySrc");
+  demux = gst_element_factory_make("matroskademux", "replayDemux");
+  pace = gst_element_factory_make("identity", "replayPace");
+  if (!src || !demux || !pace) {
+    g_printerr("Could not create the replay elements\n");
+    gst_object_unref(bin);
+    return NULL;
+  }
+  gst_bin_add_many(GST_BIN(bin), src, demux, pace, NULL);
+  gst_element_link(src, demux);
+  GstPad *paceSrcPad = gst_element_get_static_pad(pace, "src");
+  gst_element_add_pad(bin, gst_ghost_pad_new("src", paceSrcPad));
+  gst_object_unref(paceSrcPad);
+
+  // random access lets the demuxer pull ranges, which appsrc answers through the callbacks
+  gst_app_src_set_stream_type(GST_APP_SRC(src), GST_APP_STREAM_TYPE_RANDOM_ACCESS);
+  gst_app_src_set_size(GST_APP_SRC(src), g_mapped_file_get_length(file));
+  GstAppSrcCallbacks callbacks = {};
+  callbacks.need_data = need_data_cb;
+  callbacks.seek_data = seek_data_cb;
+  gst_app_src_set_callbacks(GST_APP_SRC(src), &callbacks, this, NULL);
+  g_signal_connect(demux, "pad-added", G_CALLBACK(pad_added_cb), this);
+  GstPad *srcPad = gst_element_get_static_pad(src, "src");
+  gst_pad_add_probe(srcPad, GST_PAD_PROBE_TYPE_QUERY_UPSTREAM, activate_cb, this, NULL);
+  gst_object_unref(srcPad);
+  g_object_set(G_OBJECT(pace), "sync", !fast, NULL);
+  GstPad *paceSinkPad = gst_element_get_static_pad(pace, "sink");
+  gst_pad_add_probe(paceSinkPad,
+                    (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM |
+                                      GST_PAD_PROBE_TYPE_EVENT_FLUSH),
+                    timeline_cb, this, NULL);
+  gst_object_unref(paceSinkPad);
+  return bin;
+}
+
+void ReplaySource::need_data_cb(GstAppSrc *src, guint length, gpointer user_data) {
+  auto self = static_cast<ReplaySource *>(user_data);
+  gsize size = g_mapped_file_get_length(self->file);
+  if (self->offset >= size) {
+    gst_app_src_end_of_stream(src);
+    return;
+  }
+  gsize available = std::min<gsize>(length, size - self->offset);
+  // the buffer keeps the mapping alive, it is not copied
+  GstBuffer *buffer =
+      gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, g_mapped_file_get_contents(self->file), size,
+                                  self->offset, available, g_mapped_file_ref(self->file),
+                                  (GDestroyNotify)g_mapped_file_unref);
+  GST_BUFFER_OFFSET(buffer) = self->offset;
+  self->offset += available;
+  gst_app_src_push_buffer(src, buffer);
+}
+
+gboolean ReplaySource::seek_data_cb(GstAppSrc *src, guint64 offset, gpointer user_data) {
+  static_cast<ReplaySource *>(user_data)->offset = offset;
+  return TRUE;
+}
+
+// The demuxer asks how it can schedule every time it is activated, which is where a restarted pipeline reads the
+// file from the start again
+GstPadProbeReturn ReplaySource::activate_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  auto self = static_cast<ReplaySource *>(user_data);
+  if (GST_QUERY_TYPE(GST_PAD_PROBE_INFO_QUERY(info)) != GST_QUERY_SCHEDULING)
+    return GST_PAD_PROBE_OK;
+  self->offset = 0;
+  self->segmentSent = false;
+  self->streamStarted = false;
+  self->passStart = GST_CLOCK_TIME_NONE;
+  self->passOffset = 0;
+  self->end = 0;
+  return GST_PAD_PROBE_OK;
+}
+
+void ReplaySource::pad_added_cb(GstElement *element, GstPad *pad, gpointer user_data) {
+  auto self = static_cast<ReplaySource *>(user_data);
+  GstPad *paceSinkPad = gst_element_get_static_pad(self->pace, "sink");
+  if (!gst_pad_is_linked(paceSinkPad) && gst_pad_link(pad, paceSinkPad) != GST_PAD_LINK_OK)
+    g_printerr("Could not link the replayed video track\n");
+  gst_object_unref(paceSinkPad);
+}
+
+// Keeps one continuous timeline across passes: each pass is rebased to start where the previous one ended, only the
+// first segment and stream start get through and the flushes and EOS of a restart are swallowed
+GstPadProbeReturn ReplaySource::timeline_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  auto self = static_cast<ReplaySource *>(user_data);
+  if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!GST_BUFFER_PTS_IS_VALID(buffer))
+      return GST_PAD_PROBE_OK;
+    if (!GST_CLOCK_TIME_IS_VALID(self->passStart))
+      self->passStart = GST_BUFFER_PTS(buffer);
+    // metadata only, the frame data stays in the mapping
+    buffer = gst_buffer_make_writable(buffer);
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+    GST_BUFFER_PTS(buffer) = pts - std::min(self->passStart, pts) + self->passOffset;
+    GST_BUFFER_DTS(buffer) = GST_CLOCK_TIME_NONE;
+    self->end = GST_BUFFER_PTS(buffer) + (GST_BUFFER_DURATION_IS_VALID(buffer) ? GST_BUFFER_DURATION(buffer) : 0);
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    self->frames++;
+    return GST_PAD_PROBE_OK;
+  }
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+  switch (GST_EVENT_TYPE(event)) {
+  case GST_EVENT_FLUSH_START:
+  case GST_EVENT_FLUSH_STOP:
+    return GST_PAD_PROBE_DROP;
+  case GST_EVENT_STREAM_START:
+    if (self->streamStarted)
+      return GST_PAD_PROBE_DROP;
+    self->streamStarted = true;
+    return GST_PAD_PROBE_OK;
+  case GST_EVENT_SEGMENT: {
+    if (self->segmentSent)
+      return GST_PAD_PROBE_DROP;
+    self->segmentSent = true;
+    // the rebased timeline starts at 0 whatever the recording's timestamps are
+    GstSegment segment;
+    gst_segment_init(&segment, GST_FORMAT_TIME);
+    gst_event_unref(event);
+    GST_PAD_PROBE_INFO_DATA(info) = gst_event_new_segment(&segment);
+    return GST_PAD_PROBE_OK;
+  }
+  case GST_EVENT_EOS:
+    if (!self->loop)
+      return GST_PAD_PROBE_OK;
+    // seeking would wait for this streaming thread, so the restart happens on the main loop
+    g_idle_add(restart_cb, self);
+    return GST_PAD_PROBE_DROP;
+  default:
+    return GST_PAD_PROBE_OK;
+  }
+}
+
+gboolean ReplaySource::restart_cb(gpointer user_data) {
+  auto self = static_cast<ReplaySource *>(user_data);
+  // the next pass starts where the last frame of this one ended
+  self->passOffset = self->end;
+  self->passStart = GST_CLOCK_TIME_NONE;
+  self->loops++;
+  if (!gst_element_seek_simple(self->demux, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH, 0))
+    g_printerr("Could not restart the replay\n");
+  return G_SOURCE_REMOVE;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <atomic>
+#include <gst/app/app.h>
+#include <gst/gst.h>
+#include <string>
+
+// Plays a recording back in place of the camera, so benchmarks and regression tests run on real footage without
+// one. The file is memory mapped and handed to matroskademux in pull mode as buffers pointing into the mapping, so
+// no read calls or copies skew measurements. Frames leave at their recorded timestamps, or as fast as the pipeline
+// takes them, and looping restarts the file while the timestamps keep increasing as if the camera kept running.
+class ReplaySource {
+public:
+  std::string path;
+  bool loop = false;
+  bool fast = false;
+  std::atomic<guint64> frames{0};
+  std::atomic<guint64> loops{0};
+
+  ~ReplaySource();
+  // a bin named videosrc with an image/jpeg src pad, NULL if the file can not be mapped
+  GstElement *create();
+
+private:
+  GMappedFile *file = NULL;
+  // position of the next range handed to the demuxer, only used on its streaming thread
+  guint64 offset = 0;
+  GstElement *demux = NULL;
+  GstElement *pace = NULL;
+  // Output timeline, a pass over the file starts where the previous one ended. Reset when the demuxer is activated.
+  bool segmentSent = false;
+  bool streamStarted = false;
+  GstClockTime passStart = GST_CLOCK_TIME_NONE;
+  GstClockTime passOffset = 0;
+  GstClockTime end = 0;
+
+  static void need_data_cb(GstAppSrc *src, guint length, gpointer user_data);
+  static gboolean seek_data_cb(GstAppSrc *src, guint64 offset, gpointer user_data);
+  static GstPadProbeReturn activate_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+  static void pad_added_cb(GstElement *element, GstPad *pad, gpointer user_data);
+  static GstPadProbeReturn timeline_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+  static gboolean restart_cb(gpointer user_data);
+};
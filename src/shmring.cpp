@@ -0,0 +1,195 @@
+#include "shmring.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <glib-unix.h>
+#include <linux/futex.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const size_t PAGE_ALIGN = 4096;
+
+static size_t alignUp(size_t value, size_t alignment) { return (value + alignment - 1) / alignment * alignment; }
+
+ShmRing::~ShmRing() {
+  for (int fd : consumers)
+    close(fd);
+  if (listenFd >= 0) {
+    close(listenFd);
+    unlink(socketPath.c_str());
+  }
+  if (map)
+    munmap(map, mapSize);
+  if (memfd >= 0)
+    close(memfd);
+  if (readOnlyFd >= 0)
+    close(readOnlyFd);
+}
+
+bool ShmRing::start(int width, int height) {
+  // an MJPEG frame does not get larger than the raw YUY2 frame
+  if (slotSize == 0)
+    slotSize = alignUp((size_t)width * height * 2, PAGE_ALIGN);
+  size_t descriptorOffset = alignUp(sizeof(ShmRingHeader), 64);
+  size_t dataOffset = alignUp(descriptorOffset + slotCount * sizeof(ShmRingSlot), PAGE_ALIGN);
+  mapSize = dataOffset + (size_t)slotCount * slotSize;
+
+  memfd = memfd_create("cam2rtpfile-frames", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (memfd < 0 || ftruncate(memfd, mapSize) != 0) {
+    g_printerr("Could not create the shared frame ring: %s\n", g_strerror(errno));
+    return false;
+  }
+  // consumers can not resize the ring under the writer
+  fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW);
+  map = (uint8_t *)mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+  if (map == MAP_FAILED) {
+    map = NULL;
+    g_printerr("Could not map the shared frame ring: %s\n", g_strerror(errno));
+    return false;
+  }
+  // Consumers get a read only descriptor, so they can not map the ring writable. Where the kernel supports it the
+  // ring is also sealed against new writable mappings, which keeps them from reopening it for writing, the mapping
+  // above stays writable.
+  readOnlyFd = open(("/proc/self/fd/" + std::to_string(memfd)).c_str(), O_RDONLY | O_CLOEXEC);
+  if (readOnlyFd < 0) {
+    g_printerr("Could not open the shared frame ring read only: %s\n", g_strerror(errno));
+    return false;
+  }
+#ifdef F_SEAL_FUTURE_WRITE
+  fcntl(memfd, F_ADD_SEALS, F_SEAL_FUTURE_WRITE);
+#endif
+  fcntl(memfd, F_ADD_SEALS, F_SEAL_SEAL);
+  header = new (map) ShmRingHeader();
+  header->magic = SHM_RING_MAGIC;
+  header->version = SHM_RING_VERSION;
+  header->slotCount = slotCount;
+  header->slotSize = slotSize;
+  header->descriptorOffset = descriptorOffset;
+  header->dataOffset = dataOffset;
+  for (uint32_t i = 0; i < slotCount; i++)
+    new (map + descriptorOffset + i * sizeof(ShmRingSlot)) ShmRingSlot();
+
+  listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof(addr.sun_path)) {
+    g_printerr("Socket path %s is too long\n", socketPath.c_str());
+    return false;
+  }
+  strcpy(addr.sun_path, socketPath.c_str());
+  unlink(socketPath.c_str());
+  if (listenFd < 0 || bind(listenFd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenFd, 8) != 0) {
+    g_printerr("Could not listen on %s: %s\n", socketPath.c_str(), g_strerror(errno));
+    return false;
+  }
+  g_unix_fd_add(listenFd, G_IO_IN, accept_cb, this);
+  return true;
+}
+
+ShmRingSlot *ShmRing::slot(uint64_t frame) {
+  return reinterpret_cast<ShmRingSlot *>(map + header->descriptorOffset) + frame % slotCount;
+}
+
+void ShmRing::publish(const uint8_t *data, size_t size, uint64_t pts) {
+  if (!header)
+    return;
+  if (size > slotSize) {
+    oversized++;
+    return;
+  }
+  uint64_t frame = header->frame.load(std::memory_order_relaxed) + 1;
+  ShmRingSlot *s = slot(frame);
+  uint64_t sequence = s->sequence.load(std::memory_order_relaxed);
+  s->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(map + header->dataOffset + (frame % slotCount) * (uint64_t)slotSize, data, size);
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  s->frame = frame;
+  s->pts = pts;
+  s->published = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+  s->size = size;
+  s->sequence.store(sequence + 2, std::memory_order_release);
+  header->frame.store(frame, std::memory_order_release);
+  header->futex.fetch_add(1, std::memory_order_release);
+  // the wake is a syscall, readers that only poll do not need it
+  if (waiterCount.load(std::memory_order_relaxed) > 0)
+    syscall(SYS_futex, &header->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+  published++;
+}
+
+size_t ShmRing::consumerCount() {
+  std::lock_guard<std::mutex> lock(consumersMutex);
+  return consumers.size();
+}
+
+// hand the memfd and its size to a new consumer, the connection stays open to track it
+gboolean ShmRing::accept_cb(gint fd, GIOCondition condition, gpointer user_data) {
+  auto self = static_cast<ShmRing *>(user_data);
+  int consumer = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+  if (consumer < 0)
+    return G_SOURCE_CONTINUE;
+  uint64_t size = self->mapSize;
+  iovec iov = {&size, sizeof(size)};
+  char control[CMSG_SPACE(sizeof(int))] = {};
+  msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &self->readOnlyFd, sizeof(int));
+  if (sendmsg(consumer, &msg, MSG_NOSIGNAL) < 0) {
+    g_printerr("Could not send the frame ring to a consumer: %s\n", g_strerror(errno));
+    close(consumer);
+    return G_SOURCE_CONTINUE;
+  }
+  {
+    std::lock_guard<std::mutex> lock(self->consumersMutex);
+    self->consumers.push_back(consumer);
+  }
+  g_unix_fd_add(consumer, (GIOCondition)(G_IO_IN | G_IO_HUP | G_IO_ERR), consumer_cb, self);
+  g_print("Frame ring consumer connected\n");
+  return G_SOURCE_CONTINUE;
+}
+
+// consumers only send SHM_RING_WAKE, end of stream or an error means the connection closed
+gboolean ShmRing::consumer_cb(gint fd, GIOCondition condition, gpointer user_data) {
+  auto self = static_cast<ShmRing *>(user_data);
+  char buffer[64];
+  ssize_t received = (condition & G_IO_IN) ? recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT) : 0;
+  if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return G_SOURCE_CONTINUE;
+  if (received > 0) {
+    if (memchr(buffer, SHM_RING_WAKE, received)) {
+      {
+        std::lock_guard<std::mutex> lock(self->consumersMutex);
+        if (std::find(self->waiters.begin(), self->waiters.end(), fd) == self->waiters.end())
+          self->waiters.push_back(fd);
+        self->waiterCount = self->waiters.size();
+      }
+      // every frame published from now on wakes the futex, the reader blocks only once it got this
+      send(fd, &SHM_RING_WAKE, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+    return G_SOURCE_CONTINUE;
+  }
+  {
+    std::lock_guard<std::mutex> lock(self->consumersMutex);
+    self->consumers.erase(std::remove(self->consumers.begin(), self->consumers.end(), fd), self->consumers.end());
+    self->waiters.erase(std::remove(self->waiters.begin(), self->waiters.end(), fd), self->waiters.end());
+    self->waiterCount = self->waiters.size();
+  }
+  close(fd);
+  g_print("Frame ring consumer disconnected\n");
+  return G_SOURCE_REMOVE;
+}
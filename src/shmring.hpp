@@ -0,0 +1,90 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <glib.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Shared memory frame ring for local consumers, such as the onboard tracker.
+//
+// The ring lives in a sealed memfd. A consumer connects to the Unix socket, receives a read only descriptor of the
+// memfd with SCM_RIGHTS and maps it, after that it reads frames in place without any syscalls. Keeping the socket
+// open registers the consumer, closing it unregisters it.
+//
+// Every slot is guarded by a seqlock: the sequence is odd while the slot is written. A reader loads the sequence,
+// reads the descriptor and data, then loads the sequence again and discards the frame if either value was odd or
+// they differ. The newest frame number is in ShmRingHeader::frame, frame n is in slot n % slotCount.
+// ShmRingHeader::futex is incremented for every frame. Readers that want to block on it with FUTEX_WAIT first send
+// SHM_RING_WAKE over the socket and wait for the writer to send it back, the writer only issues FUTEX_WAKE while
+// such a reader is connected. Once it is back every frame wakes the futex. A reader then loads futex, checks
+// ShmRingHeader::frame for a frame it has not read yet and otherwise waits with the loaded value, so a frame
+// published in between makes the wait return at once.
+const uint32_t SHM_RING_MAGIC = 0x524d4143; // "CAMR"
+const uint32_t SHM_RING_VERSION = 2;
+const char SHM_RING_WAKE = 'w';
+
+struct alignas(64) ShmRingHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slotCount;
+  uint32_t slotSize;
+  uint64_t descriptorOffset;
+  uint64_t dataOffset;
+  std::atomic<uint64_t> frame;
+  std::atomic<uint32_t> futex;
+};
+
+struct alignas(64) ShmRingSlot {
+  std::atomic<uint64_t> sequence;
+  uint64_t frame;
+  uint64_t pts;       // buffer timestamp in ns
+  uint64_t published; // CLOCK_MONOTONIC in ns when the frame became readable, for measuring delivery latency
+  uint64_t size;      // bytes of JPEG data
+};
+
+inline const ShmRingSlot *shmRingSlot(const ShmRingHeader *header, uint64_t frame) {
+  auto base = reinterpret_cast<const uint8_t *>(header) + header->descriptorOffset;
+  return reinterpret_cast<const ShmRingSlot *>(base) + frame % header->slotCount;
+}
+
+inline const uint8_t *shmRingData(const ShmRingHeader *header, uint64_t frame) {
+  return reinterpret_cast<const uint8_t *>(header) + header->dataOffset +
+         (frame % header->slotCount) * (uint64_t)header->slotSize;
+}
+
+// Writer side, owned by the capture process. Linux only.
+class ShmRing {
+public:
+  std::string socketPath;
+  uint32_t slotCount = 8;
+  // 0 sizes the slots for the largest frame at the capture resolution
+  uint32_t slotSize = 0;
+  std::atomic<guint64> published{0};
+  std::atomic<guint64> oversized{0};
+
+  ~ShmRing();
+  bool start(int width, int height);
+  // copy a frame into the next slot and wake blocked readers
+  void publish(const uint8_t *data, size_t size, uint64_t pts);
+  size_t consumerCount();
+
+private:
+  int memfd = -1;
+  // the same ring opened read only, handed to consumers
+  int readOnlyFd = -1;
+  int listenFd = -1;
+  uint8_t *map = NULL;
+  size_t mapSize = 0;
+  ShmRingHeader *header = NULL;
+  std::vector<int> consumers;
+  // consumers that asked to be woken, the count is read for every frame
+  std::vector<int> waiters;
+  std::atomic<uint32_t> waiterCount{0};
+  std::mutex consumersMutex;
+
+  ShmRingSlot *slot(uint64_t frame);
+  static gboolean accept_cb(gint fd, GIOCondition condition, gpointer user_data);
+  static gboolean consumer_cb(gint fd, GIOCondition condition, gpointer user_data);
+};
@@ -1,16 +1,49 @@
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
 #include <cxxopts.hpp>
 #include <exception>
 #include <fstream>
+#include <functional>
+#include <gio/gio.h>
+#include <gst/app/app.h>
 #include <gst/gst.h>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <regex>
 #include <sstream>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include "jpeg.hpp"
+#include "jpegpay.hpp"
+#include "packetpool.hpp"
+#include "playback.hpp"
+#include "recordindex.hpp"
+#include "replay.hpp"
+#include "transcodedstream.hpp"
+#ifdef COUNT_ALLOCATIONS
+#include "alloccount.hpp"
+#endif
+#ifdef HAVE_LIBJPEG
+#include "framecache.hpp"
+#include "transcode.hpp"
+#endif
+
+#ifdef HAVE_RTSP_SERVER
+#include <gst/rtsp-server/rtsp-server.h>
+#endif
+#ifdef HAVE_WEBRTC
+#include "webrtc.hpp"
+#endif
+
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
 #define OS_WINDOWS 1
 #include <Ws2tcpip.h>
@@ -20,13 +53,25 @@
 #elif __linux__
 #define OS_LINUX 1
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include <netdb.h>
 #include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #define NULL_FILE "/dev/null"
 #define VIDEO_SOURCE "v4l2src"
 #else
 #error "Unknown compiler"
 #endif
 
+#ifdef OS_LINUX
+#include "shmring.hpp"
+#endif
+
 std::string string_join(const std::vector<std::string> &strings, const std::string &delimiter) {
   std::string result;
   for (const auto &string : strings)
@@ -34,20 +79,302 @@ std::string string_join(const std::vector<std::string> &strings, const std::stri
   return result.substr(0, result.length() - delimiter.length());
 }
 
+bool parseResolution(const std::string &resolution, int &width, int &height) {
+  std::regex resRegex("([0-9]+)x([0-9]+)");
+  std::smatch resMatch;
+  if (!std::regex_match(resolution, resMatch, resRegex))
+    return false;
+  width = std::stoi(resMatch[1]);
+  height = std::stoi(resMatch[2]);
+  return true;
+}
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// One-shot pad probe which reports how long it took until the first buffer passed the pad, optionally only counting
+// buffers after a new caps event, and then runs a follow-up action with the elapsed time on the main loop
+struct FirstBufferProbe {
+  std::string label;
+  std::chrono::steady_clock::time_point start;
+  bool waitForCaps;
+  std::function<void(double)> then;
+  bool sawCaps = false;
+};
+
+static gboolean first_buffer_then_cb(gpointer user_data) {
+  auto then = static_cast<std::function<void()> *>(user_data);
+  (*then)();
+  delete then;
+  return G_SOURCE_REMOVE;
+}
+
+static GstPadProbeReturn first_buffer_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  auto probe = static_cast<FirstBufferProbe *>(user_data);
+  if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_CAPS)
+      probe->sawCaps = true;
+    return GST_PAD_PROBE_OK;
+  }
+  if (probe->waitForCaps && !probe->sawCaps)
+    return GST_PAD_PROBE_OK;
+  double ms = elapsedMs(probe->start);
+  if (!probe->label.empty())
+    g_print("%s took %.1f ms\n", probe->label.c_str(), ms);
+  if (probe->then) {
+    auto then = probe->then;
+    g_idle_add(first_buffer_then_cb, new std::function<void()>([then, ms]() { then(ms); }));
+  }
+  return GST_PAD_PROBE_REMOVE;
+}
+
+static void first_buffer_free(gpointer user_data) { delete static_cast<FirstBufferProbe *>(user_data); }
+
+void watchFirstBuffer(GstElement *element, const char *padName, std::string label, bool waitForCaps,
+                      std::function<void(double)> then = nullptr,
+                      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now()) {
+  GstPad *pad = gst_element_get_static_pad(element, padName);
+  auto probe = new FirstBufferProbe{label, start, waitForCaps, then};
+  gst_pad_add_probe(pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+                    first_buffer_cb, probe, first_buffer_free);
+  gst_object_unref(pad);
+}
+
+std::string cacheDir(const std::string &dir) {
+  return dir.empty() ? std::string(g_get_user_cache_dir()) + G_DIR_SEPARATOR_S "cam2rtpfile" : dir;
+}
+
+// A link-local IPv6 destination is only valid together with its interface (fe80::1%eth0), but multiudpsink parses
+// destinations into a GInetAddress, which has no scope id, so sending to them fails. They are refused up front.
+bool isScopedAddress(const sockaddr *addr) {
+  if (addr->sa_family != AF_INET6)
+    return false;
+  auto addr6 = (const sockaddr_in6 *)addr;
+  return addr6->sin6_scope_id || IN6_IS_ADDR_LINKLOCAL(&addr6->sin6_addr);
+}
+bool isScopedAddress(const std::string &host) {
+  addrinfo hints = {};
+  hints.ai_family = AF_INET6;
+  hints.ai_flags = AI_NUMERICHOST;
+  addrinfo *info = NULL;
+  if (getaddrinfo(host.c_str(), NULL, &hints, &info) != 0)
+    return false;
+  bool scoped = isScopedAddress(info->ai_addr);
+  freeaddrinfo(info);
+  return scoped;
+}
+
+// Splits host:port or [ipv6]:port, the host may be an IPv4 literal or a hostname
+bool parseHostPort(const std::string &address, std::string &host, int &port) {
+  std::regex addressRegex("(?:\\[([0-9A-Fa-f:.]+)\\]|([A-Za-z0-9.-]+)):([0-9]{1,5})");
+  std::smatch addressMatch;
+  if (!std::regex_match(address, addressMatch, addressRegex))
+    return false;
+  host = addressMatch[1].matched ? addressMatch[1] : addressMatch[2];
+  port = std::stoi(addressMatch[3]);
+  return port > 0 && port <= 65535 && !isScopedAddress(host);
+}
+
+bool isHostname(const std::string &host) { return std::regex_match(host, std::regex("[A-Za-z0-9]([A-Za-z0-9.-]*)")); }
+
+// Lower quality versions of the stream that clients can be assigned to, by libjpeg quality. Tier 0 is the camera's
+// own frames, tier n is QUALITY_TIERS[n - 1].
+struct QualityTier {
+  const char *name;
+  int quality;
+};
+const QualityTier QUALITY_TIERS[] = {{"high", 75}, {"medium", 50}, {"low", 25}};
+
+// tier by name, full is the camera's own frames, -1 if unknown
+int parseTier(const std::string &name) {
+  if (name == "full")
+    return 0;
+  for (size_t i = 0; i < G_N_ELEMENTS(QUALITY_TIERS); i++)
+    if (name == QUALITY_TIERS[i].name)
+      return i + 1;
+  return -1;
+}
+
+// Part of the frame sent to a client instead of the whole frame, in pixels of the camera frame
+struct Roi {
+  int x = 0;
+  int y = 0;
+  int width = 0;
+  int height = 0;
+  bool empty() const { return width <= 0 || height <= 0; }
+  std::string toString() const {
+    return std::to_string(x) + "," + std::to_string(y) + "," + std::to_string(width) + "x" + std::to_string(height);
+  }
+};
+
 struct Client {
-  sockaddr_in addr;
-  Client(std::string ip, int port) {
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    inet_pton(addr.sin_family, ip.c_str(), &addr.sin_addr);
+  // as given by the user, an IPv4 or IPv6 literal or a hostname
+  std::string host;
+  int port;
+  // client can join the multicast group instead of getting its own copy
+  bool multicast;
+  // quality tier sent to the client, only tier 0 is served by the multicast group
+  int tier = 0;
+  // a client with a region of interest gets a stream of its own with the crop at camera quality instead of its tier
+  Roi roi;
+  int roiStream = 0;
+  // host has to be resolved before the client can be served
+  bool hostname;
+  bool resolved = false;
+  sockaddr_storage addr;
+  Client(std::string host, int port, bool multicast = false) : host(host), port(port), multicast(multicast) {
+    hostname = !setAddress(host);
+  }
+  // set the address from a numeric IPv4 or IPv6 string
+  bool setAddress(const std::string &ip) {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_flags = AI_NUMERICHOST;
+    addrinfo *info = NULL;
+    if (getaddrinfo(ip.c_str(), NULL, &hints, &info) != 0)
+      return false;
+    if (isScopedAddress(info->ai_addr)) {
+      freeaddrinfo(info);
+      return false;
+    }
+    memset(&addr, 0, sizeof(addr));
+    memcpy(&addr, info->ai_addr, info->ai_addrlen);
+    freeaddrinfo(info);
+    if (addr.ss_family == AF_INET6)
+      ((sockaddr_in6 *)&addr)->sin6_port = htons(port);
+    else
+      ((sockaddr_in *)&addr)->sin_port = htons(port);
+    resolved = true;
+    return true;
+  }
+  bool isIpv6() const { return resolved && addr.ss_family == AF_INET6; }
+  bool isMulticastGroup() const {
+    if (!resolved)
+      return false;
+    if (isIpv6())
+      return IN6_IS_ADDR_MULTICAST(&((const sockaddr_in6 *)&addr)->sin6_addr);
+    return IN_MULTICAST(ntohl(((const sockaddr_in *)&addr)->sin_addr.s_addr));
+  }
+  // numeric address as multiudpsink expects it, empty while unresolved
+  std::string ip() const {
+    if (!resolved)
+      return "";
+    char ip[INET6_ADDRSTRLEN];
+    if (isIpv6())
+      inet_ntop(AF_INET6, &((const sockaddr_in6 *)&addr)->sin6_addr, ip, sizeof(ip));
+    else
+      inet_ntop(AF_INET, &((const sockaddr_in *)&addr)->sin_addr, ip, sizeof(ip));
+    return ip;
   }
-  std::string toString() {
-    char ip[20];
-    inet_ntop(addr.sin_family, &addr.sin_addr, ip, 20);
-    return std::string(ip) + ":" + std::to_string(ntohs(addr.sin_port));
+  std::string toString() const {
+    std::string address = resolved ? ip() : host;
+    if (isIpv6())
+      address = "[" + address + "]";
+    address += ":" + std::to_string(port);
+    if (hostname)
+      address = host + (resolved ? " (" + address + ")" : " (unresolved)");
+    return address;
+  }
+  bool sameAddress(const Client &other) const {
+    if (!resolved || !other.resolved || addr.ss_family != other.addr.ss_family)
+      return false;
+    if (isIpv6())
+      return !memcmp(&((const sockaddr_in6 *)&addr)->sin6_addr, &((const sockaddr_in6 *)&other.addr)->sin6_addr,
+                     sizeof(in6_addr));
+    return ((const sockaddr_in *)&addr)->sin_addr.s_addr == ((const sockaddr_in *)&other.addr)->sin_addr.s_addr;
   }
   bool operator==(const Client &other) const {
-    return addr.sin_addr.s_addr == other.addr.sin_addr.s_addr && addr.sin_port == other.addr.sin_port;
+    return port == other.port && (host == other.host || sameAddress(other));
+  }
+};
+
+// Streaming threads that can be configured, by the name of the element owning the task
+const std::map<std::string, std::string> THREAD_ROLES = {{"videosrc", "capture"},
+                                                         {"replayDemux", "capture"},
+                                                         {"rtpQueue", "network"},
+                                                         {"recordQueue", "record"},
+                                                         {"srtQueue", "srt"},
+                                                         {"rtspQueue", "rtsp"},
+                                                         {"previewQueue", "preview"},
+                                                         {"highQueue", "tier"},
+                                                         {"mediumQueue", "tier"},
+                                                         {"lowQueue", "tier"}};
+
+// CPUs a streaming thread may run on and its SCHED_FIFO priority, 0 leaves it on the normal scheduler
+struct ThreadProfile {
+  std::vector<int> cpus;
+  int priority = 0;
+};
+
+// parse <role>:<cpu>[-<cpu>][:<priority>]
+bool parseThreadProfile(const std::string &spec, std::string &role, ThreadProfile &profile) {
+  std::regex profileRegex("([a-z]+):([0-9]+)(?:-([0-9]+))?(?::([0-9]+))?");
+  std::smatch profileMatch;
+  if (!std::regex_match(spec, profileMatch, profileRegex))
+    return false;
+  role = profileMatch[1];
+  if (std::none_of(THREAD_ROLES.begin(), THREAD_ROLES.end(), [&](const std::pair<const std::string, std::string> &r) {
+        return r.second == role;
+      }))
+    return false;
+  int first = std::stoi(profileMatch[2]);
+  int last = profileMatch[3].matched ? std::stoi(profileMatch[3]) : first;
+  if (last < first)
+    return false;
+  profile.cpus.clear();
+  for (int cpu = first; cpu <= last; cpu++)
+    profile.cpus.push_back(cpu);
+  profile.priority = profileMatch[4].matched ? std::stoi(profileMatch[4]) : 0;
+  return profile.priority <= 99;
+}
+
+// What happens to frames that fail validation
+enum CorruptFrames { CORRUPT_DROP, CORRUPT_FLAG, CORRUPT_PASS };
+
+// How the pipeline idles while nothing consumes the stream: PAUSED stops dequeuing frames but keeps the camera
+// streaming so resuming takes at most a frame, READY also stops the camera and frees its buffers
+enum IdlePark { IDLE_PARK_OFF, IDLE_PARK_PAUSE, IDLE_PARK_READY };
+// how long demand has to be gone before the pipeline parks, so a client re-adding itself does not cause a restart
+const std::chrono::seconds IDLE_PARK_DELAY(2);
+
+// Delay before the first attempt to recover from a pipeline error, doubled for every attempt that fails up to the
+// maximum
+const guint RECOVER_BACKOFF_MS = 250;
+const guint RECOVER_BACKOFF_MAX_MS = 8000;
+// how long a closing recording gets for its EOS to reach the file before it is closed without its cues
+const guint RECORD_DRAIN_MS = 2000;
+
+// Packets preallocated for the network branch, a 1080p frame is a few hundred packets
+const guint PACKET_POOL_SIZE = 512;
+
+// Age of the frames handed to the payloader and the frames dropped on the way there, per reason
+struct SendStats {
+  std::mutex mutex;
+  guint64 sent = 0;
+  guint64 late = 0;
+  guint64 overrun = 0;
+  // ages and intervals since the previous frame in ms of the most recent frames, the spread of the intervals is the
+  // send jitter
+  std::vector<double> ages = std::vector<double>(1024);
+  std::vector<double> intervals = std::vector<double>(1024);
+  size_t count = 0;
+  GstClockTime lastSent = GST_CLOCK_TIME_NONE;
+
+  void record(double ms, GstClockTime now) {
+    bool first = !GST_CLOCK_TIME_IS_VALID(lastSent);
+    intervals[count % intervals.size()] = first ? 0 : (double)(now - lastSent) / GST_MSECOND;
+    ages[count++ % ages.size()] = ms;
+    lastSent = now;
+    sent++;
+  }
+  double percentile(const std::vector<double> &values, double p) {
+    std::vector<double> recent(values.begin(), values.begin() + std::min(count, values.size()));
+    if (recent.empty())
+      return 0;
+    auto nth = recent.begin() + (size_t)(p * (recent.size() - 1));
+    std::nth_element(recent.begin(), nth, recent.end());
+    return *nth;
   }
 };
 
@@ -55,9 +382,44 @@ class CameraData {
 public:
   // Static options
   std::string cameraPath;
-  int framerate;
-  int width;
-  int height;
+  int framerate = 0;
+  int width = 0;
+  int height = 0;
+  std::string capsCacheDir;
+  bool reprobe = false;
+  std::string thumbnailFile;
+  int thumbnailInterval = 5;
+  int rtspPort = 0;
+  bool multicast = false;
+  Client multicastGroup = Client("0.0.0.0", 0);
+  int multicastTtl = 1;
+  std::string multicastIface;
+  std::string srtUri;
+  int srtLatency = 125;
+  int srtStatsInterval = 5;
+  int dnsTtl = 60;
+  // frames older than this when they reach the payloader are dropped, 0 sends every frame
+  int deadlineMs = 0;
+  bool nativePayloader = false;
+  CorruptFrames corruptFrames = CORRUPT_DROP;
+  // skip frames identical to the previous one on every output
+  bool dedupe = false;
+  IdlePark idlePark = IDLE_PARK_OFF;
+  // restart the capture after errors instead of exiting
+  bool recover = false;
+  // synthetic consumers of decoded frames, to measure the frame cache
+  int decodeConsumers = 0;
+  // the preview stream is the camera frame at 1/previewScale, 0 disables it
+  int previewScale = 0;
+  int previewQuality = 50;
+  // clients can be assigned to a quality tier
+  bool qualityTiers = false;
+  // scheduling of the streaming threads by role
+  std::map<std::string, ThreadProfile> threadProfiles;
+  // Play a recording instead of capturing, when its path is set
+  ReplaySource replay;
+  // Formats the camera supports, from the caps cache
+  GstCaps *supportedCaps = NULL;
 
   // Parse video from webcam
   GstElement *pipeline = NULL;
@@ -74,8 +436,109 @@ public:
   // GstElement *jpegEnc = NULL;
   GstElement *mkvMux = NULL;
   GstElement *fileSink = NULL;
+  RecordIndexWriter recordIndex;
+  // the recording being closed while the main loop carries on, see closeRecordFile
+  struct RecordDrain {
+    CameraData *camera;
+    // finished from the main loop instead of by a waiting caller
+    bool async;
+    std::mutex mutex;
+    std::condition_variable done;
+    bool eos = false;
+  };
+  std::shared_ptr<RecordDrain> recordDrain;
+  gulong drainProbe = 0;
+  guint drainTimer = 0;
+  std::mutex drainMutex;
+  // Send video over SRT
+  GstElement *srtQueue = NULL;
+  GstElement *srtMux = NULL;
+  GstElement *srtSink = NULL;
+  // Send a downscaled preview to its own clients
+  TranscodedStream preview;
+  // Send requantized frames to clients of each quality tier
+  TranscodedStream tierStreams[G_N_ELEMENTS(QUALITY_TIERS)];
+  // Cropped stream of a client with a region of interest, the region can move while it runs
+  struct RoiStream {
+    TranscodedStream stream;
+    std::mutex mutex;
+    Roi roi;
+  };
+  // by Client::roiStream
+  std::map<int, std::unique_ptr<RoiStream>> roiStreams;
+  int nextRoiStream = 1;
+  // Recording streamed to the clients in place of the camera
+  RecordingPlayback playback;
+#ifdef OS_LINUX
+  // Share frames with local consumers
+  GstElement *shmQueue = NULL;
+  GstElement *shmSink = NULL;
+  ShmRing shm;
+#endif
+#ifdef HAVE_WEBRTC
+  // Browser viewers
+  WebRtcServer webrtc;
+#endif
+#ifdef HAVE_RTSP_SERVER
+  // Hand frames to the RTSP server
+  GstElement *rtspQueue = NULL;
+  GstElement *rtspSink = NULL;
+  GstRTSPServer *rtspServer = NULL;
+  // appsrc of the shared RTSP media while it is prepared
+  GstElement *rtspSrc = NULL;
+  std::mutex rtspMutex;
+#endif
+  SendStats sendStats;
+  // Packet buffers for the payloader
+  PacketPool packetPool;
+  // Captured frames by validation result, and the total time spent validating
+  std::atomic<guint64> frameStatus[4] = {};
+  std::atomic<guint64> validateNs{0};
+  // Repeated frames, and what skipping them saved before the tee
+  std::atomic<guint64> duplicates{0};
+  std::atomic<guint64> duplicatesSkipped{0};
+  std::atomic<guint64> duplicateBytesSaved{0};
+  std::chrono::steady_clock::time_point lastForwardedFrame;
   // Clients
   std::vector<Client> clients;
+  size_t destinations = 0;
+  // addresses currently configured on the udpsink, so updates only add and remove the difference
+  std::vector<std::pair<std::string, int>> sinkDestinations;
+  // clients of the preview stream, resolved through the same DNS cache
+  std::vector<Client> previewClients;
+  // clients are changed from the input thread and by hostname lookups finishing on the main loop
+  std::recursive_mutex clientsMutex;
+  // Resolved hostnames, shared by every client using the name and looked up again after dnsTtl seconds
+  struct CachedHost {
+    std::string ip;
+    std::chrono::steady_clock::time_point expiry;
+    bool pending = false;
+  };
+  std::map<std::string, CachedHost> dnsCache;
+  // Idle parking state
+  std::mutex parkMutex;
+  bool parked = false;
+  // paused or stopped by a command, never resumed automatically
+  bool userPaused = false;
+  std::chrono::steady_clock::time_point idleSince = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point parkedAt;
+  double parkedSeconds = 0;
+  // Recovery state, only touched on the main loop. Attempts counts the restarts of the current failure, 0 while
+  // running normally.
+  int recoverAttempts = 0;
+  guint recoverTimer = 0;
+  bool recoverPipeline = false;
+  bool recoverWasRecording = false;
+  std::chrono::steady_clock::time_point failedAt;
+  guint64 recoveries = 0;
+  double lastRecoverMs = -1;
+  // Recording state
+  bool recording = false;
+  std::string recordName;
+  int recordSegment = 0;
+  // Most recent frame entering the tee, kept for snapshots
+  GstBuffer *lastFrame = NULL;
+  std::mutex lastFrameMutex;
 
   ~CameraData() {
     // release source
@@ -108,15 +571,35 @@ public:
     //   gst_object_unref(aviMux);
     if (fileSink)
       gst_object_unref(fileSink);
+    if (supportedCaps)
+      gst_caps_unref(supportedCaps);
+    if (lastFrame)
+      gst_buffer_unref(lastFrame);
+#ifdef HAVE_RTSP_SERVER
+    if (rtspSrc)
+      gst_object_unref(rtspSrc);
+    if (rtspServer)
+      g_object_unref(rtspServer);
+#endif
   }
 
   int init() {
     pipeline = gst_pipeline_new("pipeline");
     if (!pipeline)
       g_printerr("Could not create 'pipeline'");
-    source = gst_element_factory_make(VIDEO_SOURCE, "videosrc");
-    if (!source)
+    // streaming threads announce themselves from the new thread, so they are configured in the sync handler
+    GstBus *bus = gst_element_get_bus(pipeline);
+    gst_bus_set_sync_handler(bus, stream_status_cb, this, NULL);
+    gst_object_unref(bus);
+    if (!replay.path.empty()) {
+      source = replay.create();
+      if (!source)
+        return -1;
+    } else {
+      source = gst_element_factory_make(VIDEO_SOURCE, "videosrc");
+      if (!source)
         g_printerr("Could not create '" VIDEO_SOURCE "' element");
+    }
     sourceFilter = gst_element_factory_make("capsfilter", "filter");
     if (!sourceFilter)
       g_printerr("Could not create 'capsfilter' element");
@@ -133,9 +616,10 @@ public:
     rtpQueue = gst_element_factory_make("queue", "rtpQueue");
     if (!rtpQueue)
       g_printerr("Could not create 'queue' element");
-    rtpPay = gst_element_factory_make("rtpjpegpay", "rtpPay");
+    const char *payloader = payloaderFactory();
+    rtpPay = gst_element_factory_make(payloader, "rtpPay");
     if (!rtpPay)
-      g_printerr("Could not create 'rtpjpegpay' element");
+      g_printerr("Could not create '%s' element", payloader);
     identity = gst_element_factory_make("identity", "identity");
     if (!identity)
       g_printerr("Could not create 'identity' element");
@@ -165,26 +649,19 @@ public:
       g_error("Failed to link file");
       return -1;
     }
+    recordIndex.attach(recordQueue, fileSink);
+    GstPad *sourcePad = gst_element_get_static_pad(source, "src");
+    gst_pad_add_probe(sourcePad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, source_eos_cb, this, NULL);
+    gst_object_unref(sourcePad);
 
     if (!pipeline || !source || !sourceFilter || !videoTee || !rtpQueue || !rtpPay || !identity || !udpsink ||
         !recordQueue || /*!jpegEnc ||*/ !mkvMux || !fileSink) {
       g_error("Not all elements could be created");
       return -1;
     }
-#ifdef OS_LINUX
-    g_object_set(G_OBJECT(source), "device", cameraPath.c_str(), NULL);
-    g_object_set(G_OBJECT(source), "io-mode", 2, NULL);
-#elif OS_WINDOWS
-    g_object_set(G_OBJECT(source), "device-path", cameraPath.c_str(), NULL);
-#endif
-    GstCaps *filtercaps = gst_caps_new_simple("image/jpeg",                                 //
-                                              "width", G_TYPE_INT, width,                   //
-                                              "height", G_TYPE_INT, height,                 //
-                                              "framerate", GST_TYPE_FRACTION, framerate, 1, //
-                                              "format", G_TYPE_STRING, "MJPG",              //
-                                              NULL);
-    g_object_set(G_OBJECT(sourceFilter), "caps", filtercaps, NULL);
-    gst_caps_unref(filtercaps);
+    if (replay.path.empty())
+      configureSource(source);
+    updateCaps();
 
     g_object_set(G_OBJECT(fileSink), "location", NULL_FILE, NULL);
 
@@ -192,63 +669,1354 @@ public:
     g_object_set(G_OBJECT(udpsink), "auto-multicast", true, NULL);
     g_object_set(G_OBJECT(udpsink), "sync", false, NULL);
     g_object_set(G_OBJECT(udpsink), "async", false, NULL);
+    if (multicast) {
+      g_object_set(G_OBJECT(udpsink), "ttl-mc", multicastTtl, NULL);
+      if (!multicastIface.empty())
+        g_object_set(G_OBJECT(udpsink), "multicast-iface", multicastIface.c_str(), NULL);
+    }
     updateClients();
+
+#ifdef HAVE_RTSP_SERVER
+    if (rtspPort) {
+      rtspQueue = gst_element_factory_make("queue", "rtspQueue");
+      rtspSink = gst_element_factory_make("appsink", "rtspSink");
+      if (!rtspQueue || !rtspSink) {
+        g_printerr("Could not create 'appsink' element");
+        return -1;
+      }
+      gst_bin_add_many(GST_BIN(pipeline), rtspQueue, rtspSink, NULL);
+      if (!gst_element_link_many(videoTee, rtspQueue, rtspSink, NULL)) {
+        g_printerr("Failed to link rtsp");
+        return -1;
+      }
+      g_object_set(G_OBJECT(rtspQueue), "leaky", 2, "max-size-buffers", 2, NULL);
+      g_object_set(G_OBJECT(rtspSink), "sync", false, "async", false, "max-buffers", 1, "drop", true, NULL);
+      GstAppSinkCallbacks callbacks = {};
+      callbacks.new_sample = rtsp_sample_cb;
+      gst_app_sink_set_callbacks(GST_APP_SINK(rtspSink), &callbacks, this, NULL);
+    }
+#endif
+
+    if (!srtUri.empty()) {
+      srtQueue = gst_element_factory_make("queue", "srtQueue");
+      srtMux = gst_element_factory_make("matroskamux", "srtMux");
+      srtSink = gst_element_factory_make("srtsink", "srtSink");
+      if (!srtQueue || !srtMux || !srtSink) {
+        g_printerr("Could not create 'srtsink' element");
+        return -1;
+      }
+      gst_bin_add_many(GST_BIN(pipeline), srtQueue, srtMux, srtSink, NULL);
+      if (!gst_element_link_many(videoTee, srtQueue, srtMux, srtSink, NULL)) {
+        g_printerr("Failed to link srt");
+        return -1;
+      }
+      // retransmissions must never hold back capture, frames beyond the latency window are dropped here
+      g_object_set(G_OBJECT(srtQueue), "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0, "max-size-time",
+                   (guint64)srtLatency * GST_MSECOND * 2, NULL);
+      g_object_set(G_OBJECT(srtMux), "streamable", true, NULL);
+      g_object_set(G_OBJECT(srtSink), "uri", srtUri.c_str(), "latency", srtLatency, "wait-for-connection", false,
+                   "sync", false, "async", false, NULL);
+    }
+
+#ifdef OS_LINUX
+    if (!shm.socketPath.empty()) {
+      shmQueue = gst_element_factory_make("queue", "shmQueue");
+      shmSink = gst_element_factory_make("fakesink", "shmSink");
+      if (!shmQueue || !shmSink) {
+        g_printerr("Could not create 'fakesink' element");
+        return -1;
+      }
+      gst_bin_add_many(GST_BIN(pipeline), shmQueue, shmSink, NULL);
+      if (!gst_element_link_many(videoTee, shmQueue, shmSink, NULL)) {
+        g_printerr("Failed to link shm");
+        return -1;
+      }
+      // the copy into the ring happens on the queue's thread, a slow ring write drops frames here only
+      g_object_set(G_OBJECT(shmQueue), "leaky", 2, "max-size-buffers", 2, NULL);
+      g_object_set(G_OBJECT(shmSink), "sync", false, "async", false, NULL);
+      GstPad *shmPad = gst_element_get_static_pad(shmSink, "sink");
+      gst_pad_add_probe(shmPad, GST_PAD_PROBE_TYPE_BUFFER, shm_frame_cb, this, NULL);
+      gst_object_unref(shmPad);
+    }
+#endif
+
+#ifdef HAVE_WEBRTC
+    if (webrtc.port && webrtc.init(pipeline, videoTee))
+      return -1;
+#endif
+
+#ifdef HAVE_LIBJPEG
+    // The preview is decoded at its final size by libjpeg's DCT scaling, which also makes the decode cheaper, and
+    // encoded again. The decode is shared with anything else asking for this scale.
+    if (previewScale) {
+      preview.name = "preview";
+      preview.scale = previewScale;
+      preview.transcode = [this](GstBuffer *frame, std::vector<uint8_t> &jpeg) {
+        auto decoded = getDecodedFrame(frame, previewScale, DECODED_YCBCR);
+        return decoded && encodeJpeg(*decoded, previewQuality, jpeg);
+      };
+      if (preview.init(pipeline, videoTee, payloader))
+        return -1;
+      updatePreviewClients();
+    }
+    // Quality tiers never leave the compressed domain, the coefficients are requantized to the tier's tables
+    if (qualityTiers) {
+      for (size_t i = 0; i < G_N_ELEMENTS(QUALITY_TIERS); i++) {
+        int quality = QUALITY_TIERS[i].quality;
+        tierStreams[i].name = QUALITY_TIERS[i].name;
+        tierStreams[i].transcode = [quality](GstBuffer *frame, std::vector<uint8_t> &jpeg) {
+          GstMapInfo map;
+          if (!gst_buffer_map(frame, &map, GST_MAP_READ))
+            return false;
+          bool requantized = requantizeJpeg(map.data, map.size, quality, jpeg);
+          gst_buffer_unmap(frame, &map);
+          return requantized;
+        };
+        if (tierStreams[i].init(pipeline, videoTee, payloader))
+          return -1;
+      }
+      updateClients();
+    }
+#endif
+
+#ifdef HAVE_LIBJPEG
+    // each consumer asks for the full frame, only the first one per frame decodes
+    if (decodeConsumers > 0) {
+      GstPad *rtpSrcPad = gst_element_get_static_pad(rtpQueue, "src");
+      for (int i = 0; i < decodeConsumers; i++)
+        gst_pad_add_probe(rtpSrcPad, GST_PAD_PROBE_TYPE_BUFFER, decode_consumer_cb, NULL, NULL);
+      gst_object_unref(rtpSrcPad);
+    }
+#endif
+
+    // truncated frames are caught before they reach any output
+    GstPad *filterPad = gst_element_get_static_pad(sourceFilter, "src");
+    gst_pad_add_probe(filterPad, GST_PAD_PROBE_TYPE_BUFFER, validate_frame_cb, this, NULL);
+    gst_object_unref(filterPad);
+
+    // Some cameras repeat the last frame while exposure changes. Repeats are dropped before the tee, so no output
+    // pays for them, except one per second as a keepalive. In the recording the previous frame simply lasts until the
+    // next timestamp.
+    GstPad *teePad = gst_element_get_static_pad(videoTee, "sink");
+    if (dedupe)
+      gst_pad_add_probe(teePad, GST_PAD_PROBE_TYPE_BUFFER, duplicate_frame_cb, this, NULL);
+    gst_pad_add_probe(teePad, GST_PAD_PROBE_TYPE_BUFFER, last_frame_cb, this, NULL);
+    gst_object_unref(teePad);
+
+    // Send deadline: a frame that can no longer arrive in time is dropped whole before it is payloaded, so it does
+    // not cost bandwidth or delay the frames behind it. The queue only holds a deadline's worth of frames and drops
+    // the oldest instead of blocking the tee when the network thread falls behind.
+    if (deadlineMs > 0) {
+      g_object_set(G_OBJECT(rtpQueue), "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0, "max-size-time",
+                   (guint64)deadlineMs * GST_MSECOND, "silent", false, NULL);
+      g_signal_connect(rtpQueue, "overrun", G_CALLBACK(rtp_overrun_cb), this);
+    }
+    // identity drops the allocation query before it reaches the sink, so the packet pool answers it at the payloader.
+    // Only the native payloader takes its packets from the pool, rtpjpegpay ignores it and allocates each packet.
+    guint mtu;
+    g_object_get(G_OBJECT(rtpPay), "mtu", &mtu, NULL);
+    if (packetPool.init(mtu, PACKET_POOL_SIZE)) {
+      GstPad *paySrcPad = gst_element_get_static_pad(rtpPay, "src");
+      packetPool.offer(paySrcPad);
+      gst_object_unref(paySrcPad);
+      GstPad *sinkPad = gst_element_get_static_pad(udpsink, "sink");
+      packetPool.watch(sinkPad);
+      gst_object_unref(sinkPad);
+    }
+    GstPad *payPad = gst_element_get_static_pad(rtpPay, "sink");
+    gst_pad_add_probe(payPad, GST_PAD_PROBE_TYPE_BUFFER, deadline_cb, this, NULL);
+    gst_object_unref(payPad);
     return 0;
   }
 
+  const char *payloaderFactory() { return nativePayloader ? "nativejpegpay" : "rtpjpegpay"; }
+
   // manage pipeline
-  GstStateChangeReturn play() { return gst_element_set_state(pipeline, GST_STATE_PLAYING); }
-  void pause() { gst_element_set_state(pipeline, GST_STATE_PAUSED); }
-  void stop() { gst_element_set_state(pipeline, GST_STATE_NULL); }
+  GstStateChangeReturn play() {
+    {
+      std::lock_guard<std::mutex> lock(parkMutex);
+      userPaused = false;
+      if (parked)
+        unpark();
+    }
+    return gst_element_set_state(pipeline, GST_STATE_PLAYING);
+  }
+  void pause() {
+    setUserPaused();
+    gst_element_set_state(pipeline, GST_STATE_PAUSED);
+  }
+  void stop() {
+    setUserPaused();
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+  }
+
+  // anything that needs frames right now
+  bool hasDemand() {
+    if (recording || multicast || !srtUri.empty() || !thumbnailFile.empty())
+      return true;
+    {
+      // hostnames still being resolved count, their address is about to arrive
+      std::lock_guard<std::recursive_mutex> lock(clientsMutex);
+      if (!clients.empty() || !previewClients.empty())
+        return true;
+    }
+#ifdef HAVE_RTSP_SERVER
+    {
+      std::lock_guard<std::mutex> lock(rtspMutex);
+      if (rtspSrc)
+        return true;
+    }
+#endif
+#ifdef HAVE_WEBRTC
+    if (webrtc.port && webrtc.peerCount() > 0)
+      return true;
+#endif
+#ifdef OS_LINUX
+    if (!shm.socketPath.empty() && shm.consumerCount() > 0)
+      return true;
+#endif
+    return false;
+  }
+  // park the pipeline once nobody needed frames for a while and resume it as soon as someone does. Adding a client
+  // and starting a recording call this directly, every other consumer is picked up by the periodic check.
+  void updateDemand() {
+    if (idlePark == IDLE_PARK_OFF)
+      return;
+    std::lock_guard<std::mutex> lock(parkMutex);
+    if (userPaused)
+      return;
+    auto now = std::chrono::steady_clock::now();
+    if (hasDemand()) {
+      idleSince = now;
+      if (parked)
+        unpark();
+    } else if (!parked && now - idleSince >= IDLE_PARK_DELAY) {
+      gst_element_set_state(pipeline, idlePark == IDLE_PARK_READY ? GST_STATE_READY : GST_STATE_PAUSED);
+      parked = true;
+      parkedAt = now;
+      g_print("Nothing is consuming the stream, capture parked\n");
+    }
+  }
+
+  // Called on the main loop for every pipeline error, false if the process should exit. An error from the source
+  // restarts only the source first, the rest of the pipeline keeps running with the clients configured on it. Later
+  // attempts, and errors from anywhere else, restart the whole pipeline. A recording continues in a new segment.
+  bool recoverFrom(GstMessage *message) {
+    if (!recover)
+      return false;
+    // the errors following the first one belong to the same failure
+    if (recoverTimer)
+      return true;
+    if (recoverAttempts == 0) {
+      failedAt = std::chrono::steady_clock::now();
+      recoverPipeline = false;
+      recoverWasRecording = recording;
+      if (recording)
+        closeRecordFile(false);
+    }
+    recoverAttempts++;
+    bool fromSource = GST_MESSAGE_SRC(message) == GST_OBJECT(source) ||
+                      gst_object_has_as_ancestor(GST_MESSAGE_SRC(message), GST_OBJECT(source));
+    // a replay can not be restarted on its own, the EOS it sent already reached the sinks
+    recoverPipeline = recoverPipeline || !fromSource || recoverAttempts > 1 || !replay.path.empty();
+    guint delay = std::min(RECOVER_BACKOFF_MAX_MS, RECOVER_BACKOFF_MS << std::min(recoverAttempts - 1, 5));
+    g_print("Restarting the %s in %u ms, attempt %d\n", recoverPipeline ? "pipeline" : "source", delay,
+            recoverAttempts);
+    recoverTimer = g_timeout_add(delay, recover_cb, this);
+    return true;
+  }
+  // pretend the source or another element failed, to test recovery
+  void injectError(bool fromSource) {
+    GstElement *element = fromSource ? source : udpsink;
+    GST_ELEMENT_ERROR(element, STREAM, FAILED, ("Injected error"), (NULL));
+  }
+
   int startRecord(std::string filename) {
-    gst_element_set_state(fileSink, GST_STATE_NULL);
-    gst_element_set_state(mkvMux, GST_STATE_NULL);
-    g_object_set(G_OBJECT(fileSink), "location", filename.append(".mkv").c_str(), NULL);
-    gst_element_set_state(fileSink, GST_STATE_PLAYING);
-    gst_element_set_state(mkvMux, GST_STATE_PLAYING);
-    gst_element_link_many(videoTee, recordQueue, NULL);
-    return 0;
+    recording = true;
+    updateDemand();
+    recordName = filename;
+    recordSegment = 0;
+    return openRecordFile(filename);
   }
   bool stopRecord() {
-    gst_element_set_state(fileSink, GST_STATE_NULL);
-    gst_element_set_state(mkvMux, GST_STATE_NULL);
-    g_object_set(G_OBJECT(fileSink), "location", NULL_FILE, NULL);
-    gst_element_set_state(fileSink, GST_STATE_PLAYING);
-    gst_element_set_state(mkvMux, GST_STATE_PLAYING);
-    gst_element_unlink_many(videoTee, recordQueue, NULL);
+    recording = false;
+    return closeRecordFile();
+  }
+
+  // change resolution and framerate on the fly, v4l2src renegotiates when the capsfilter changes. 1 if the mode is
+  // unchanged, -1 if the camera does not support it and -2 while a recording is replayed, which plays in its own mode.
+  int setMode(int newWidth, int newHeight, int newFramerate) {
+    if (!replay.path.empty())
+      return -2;
+    if (newWidth == width && newHeight == height && newFramerate == framerate)
+      return 1;
+    if (!supportsMode(newWidth, newHeight, newFramerate))
+      return -1;
+    // matroska does not support caps changes, so the recording continues in a new segment once the new mode arrives
+    bool wasRecording = recording;
+    if (wasRecording)
+      closeRecordFile();
+    width = newWidth;
+    height = newHeight;
+    framerate = newFramerate;
+    std::string label = "Mode switch to " + std::to_string(width) + "x" + std::to_string(height) + "@" +
+                        std::to_string(framerate);
+    watchFirstBuffer(sourceFilter, "src", label, true, [this, wasRecording](double) {
+      if (wasRecording && recording) {
+        std::string segment = recordName + "_" + std::to_string(++recordSegment);
+        g_print("Recording continues in %s.mkv\n", segment.c_str());
+        openRecordFile(segment);
+      }
+    });
+    updateCaps();
+    return 0;
+  }
+
+  // caps cache, the supported formats are probed once per device so startup does not have to wait for v4l2src to
+  // enumerate them and an unsupported mode is rejected before the pipeline is built
+  bool loadSupportedCaps() {
+    auto start = std::chrono::steady_clock::now();
+    std::string key = deviceIdentity();
+    for (auto &c : key)
+      if (!g_ascii_isalnum(c))
+        c = '_';
+    std::string dir = cacheDir(capsCacheDir);
+    std::string cacheFile = dir + G_DIR_SEPARATOR_S + key + ".caps";
+    gchar *contents = NULL;
+    if (!reprobe && g_file_get_contents(cacheFile.c_str(), &contents, NULL, NULL)) {
+      supportedCaps = gst_caps_from_string(contents);
+      g_free(contents);
+    }
+    if (supportedCaps) {
+      g_print("Loaded camera caps from %s in %.1f ms\n", cacheFile.c_str(), elapsedMs(start));
+      return true;
+    }
+    supportedCaps = probeCaps();
+    if (!supportedCaps) {
+      g_printerr("Could not probe camera caps\n");
+      return false;
+    }
+    gchar *serialized = gst_caps_to_string(supportedCaps);
+    if (g_mkdir_with_parents(dir.c_str(), 0755) != 0 ||
+        !g_file_set_contents(cacheFile.c_str(), serialized, -1, NULL))
+      g_printerr("Could not write caps cache %s\n", cacheFile.c_str());
+    g_free(serialized);
+    g_print("Probed camera caps in %.1f ms\n", elapsedMs(start));
+    return true;
+  }
+  bool supportsMode(int modeWidth, int modeHeight, int modeFramerate) {
+    if (!supportedCaps)
+      return true;
+    GstCaps *caps = modeCaps(modeWidth, modeHeight, modeFramerate);
+    bool supported = gst_caps_can_intersect(supportedCaps, caps);
+    gst_caps_unref(caps);
+    return supported;
+  }
+  // the supported mode with the most pixels, so buffers sized for it survive any setmode. The current mode if the
+  // camera's formats are unknown.
+  void largestMode(int &maxWidth, int &maxHeight) {
+    maxWidth = width;
+    maxHeight = height;
+    for (guint i = 0; supportedCaps && i < gst_caps_get_size(supportedCaps); i++) {
+      GstStructure *structure = gst_caps_get_structure(supportedCaps, i);
+      if (!gst_structure_has_name(structure, "image/jpeg"))
+        continue;
+      int modeSize[2] = {0, 0};
+      const char *fields[2] = {"width", "height"};
+      for (int f = 0; f < 2; f++) {
+        const GValue *value = gst_structure_get_value(structure, fields[f]);
+        if (value && G_VALUE_HOLDS_INT(value))
+          modeSize[f] = g_value_get_int(value);
+        else if (value && GST_VALUE_HOLDS_INT_RANGE(value))
+          modeSize[f] = gst_value_get_int_range_max(value);
+      }
+      if ((gint64)modeSize[0] * modeSize[1] > (gint64)maxWidth * maxHeight) {
+        maxWidth = modeSize[0];
+        maxHeight = modeSize[1];
+      }
+    }
+  }
+  void printSupportedModes() {
+    if (!supportedCaps)
+      return;
+    g_print("Supported modes:\n");
+    for (guint i = 0; i < gst_caps_get_size(supportedCaps); i++) {
+      GstStructure *structure = gst_caps_get_structure(supportedCaps, i);
+      if (!gst_structure_has_name(structure, "image/jpeg"))
+        continue;
+      gchar *width = gst_value_serialize(gst_structure_get_value(structure, "width"));
+      gchar *height = gst_value_serialize(gst_structure_get_value(structure, "height"));
+      gchar *framerate = gst_value_serialize(gst_structure_get_value(structure, "framerate"));
+      g_print("  %sx%s @ %s\n", width, height, framerate);
+      g_free(width);
+      g_free(height);
+      g_free(framerate);
+    }
+  }
+
+  // write the most recent frame as is, no decoding or encoding involved
+  bool snapshot(const std::string &filename) {
+    GstBuffer *frame = NULL;
+    {
+      std::lock_guard<std::mutex> lock(lastFrameMutex);
+      if (lastFrame)
+        frame = gst_buffer_ref(lastFrame);
+    }
+    if (!frame)
+      return false;
+    GstMapInfo map;
+    bool written = false;
+    if (gst_buffer_map(frame, &map, GST_MAP_READ)) {
+      written = writeJpegFile(filename, map.data, map.size);
+      gst_buffer_unmap(frame, &map);
+    }
+    gst_buffer_unref(frame);
+    return written;
+  }
+
+  // log the statistics of every SRT connection, a caller has one and a listener one per connected peer
+  void logSrtStats() {
+    if (!srtSink)
+      return;
+    GstStructure *stats = NULL;
+    g_object_get(G_OBJECT(srtSink), "stats", &stats, NULL);
+    if (!stats)
+      return;
+    const GValue *callers = gst_structure_get_value(stats, "callers");
+    if (callers && G_VALUE_HOLDS(callers, G_TYPE_VALUE_ARRAY)) {
+      GValueArray *array = (GValueArray *)g_value_get_boxed(callers);
+      for (guint i = 0; array && i < array->n_values; i++)
+        logSrtConnection(gst_value_get_structure(&array->values[i]));
+    } else {
+      logSrtConnection(stats);
+    }
+    gst_structure_free(stats);
+  }
+
+#ifdef HAVE_RTSP_SERVER
+  // all sessions share one media, fed from the capture pipeline, so there is a single camera and payloader no matter
+  // how many viewers connect
+  bool startRtspServer() {
+    rtspServer = gst_rtsp_server_new();
+    gst_rtsp_server_set_service(rtspServer, std::to_string(rtspPort).c_str());
+    GstRTSPMediaFactory *factory = gst_rtsp_media_factory_new();
+    gst_rtsp_media_factory_set_launch(
+        factory, "( appsrc name=rtspSrc is-live=true format=time do-timestamp=true ! rtpjpegpay name=pay0 pt=26 )");
+    gst_rtsp_media_factory_set_shared(factory, TRUE);
+    gst_rtsp_media_factory_set_protocols(
+        factory, (GstRTSPLowerTrans)(GST_RTSP_LOWER_TRANS_UDP | GST_RTSP_LOWER_TRANS_TCP));
+    g_signal_connect(factory, "media-configure", G_CALLBACK(rtsp_media_configure_cb), this);
+    GstRTSPMountPoints *mounts = gst_rtsp_server_get_mount_points(rtspServer);
+    gst_rtsp_mount_points_add_factory(mounts, "/stream", factory);
+    g_object_unref(mounts);
+    g_signal_connect(rtspServer, "client-connected", G_CALLBACK(rtsp_client_connected_cb), this);
+    if (gst_rtsp_server_attach(rtspServer, NULL) == 0) {
+      g_printerr("Could not start RTSP server on port %d\n", rtspPort);
+      return false;
+    }
+    g_print("RTSP server at rtsp://0.0.0.0:%d/stream\n", rtspPort);
     return true;
   }
+#endif
+
+  // bytes on the wire and process cpu time, to compare fan-out strategies
+  void printStats() {
+    guint64 bytesServed = 0;
+    g_object_get(G_OBJECT(udpsink), "bytes-served", &bytesServed, NULL);
+    std::lock_guard<std::recursive_mutex> lock(clientsMutex);
+    g_print("network destinations=%zu clients=%zu bytes_served=%" G_GUINT64_FORMAT " cpu_s=%.2f\n", destinations,
+            clients.size(), bytesServed, (double)std::clock() / CLOCKS_PER_SEC);
+    std::lock_guard<std::mutex> sendLock(sendStats.mutex);
+    g_print("deadline deadline_ms=%d sent=%" G_GUINT64_FORMAT " dropped_late=%" G_GUINT64_FORMAT
+            " dropped_overrun=%" G_GUINT64_FORMAT " age_p50_ms=%.1f age_p99_ms=%.1f interval_p50_ms=%.1f"
+            " interval_p99_ms=%.1f\n",
+            deadlineMs, sendStats.sent, sendStats.late, sendStats.overrun, sendStats.percentile(sendStats.ages, 0.5),
+            sendStats.percentile(sendStats.ages, 0.99), sendStats.percentile(sendStats.intervals, 0.5),
+            sendStats.percentile(sendStats.intervals, 0.99));
+    g_print("packets pooled=%" G_GUINT64_FORMAT " unpooled=%" G_GUINT64_FORMAT "\n", packetPool.pooled.load(),
+            packetPool.unpooled.load());
+#ifdef COUNT_ALLOCATIONS
+    g_print("heap allocations=%zu\n", allocationCount());
+#endif
+    if (recover)
+      g_print("recovery recoveries=%" G_GUINT64_FORMAT " last_recover_ms=%.1f attempts=%d\n", recoveries,
+              lastRecoverMs, recoverAttempts);
+    guint64 frames = 0;
+    std::string statuses;
+    for (int i = 0; i < 4; i++) {
+      frames += frameStatus[i];
+      statuses += std::string(" ") + JPEG_FRAME_STATUS_NAMES[i] + "=" + std::to_string(frameStatus[i]);
+    }
+    g_print("frames%s validate_us_avg=%.1f\n", statuses.c_str(), frames ? validateNs / 1000.0 / frames : 0.0);
+    if (playback.running())
+      g_print("playback file=%s position_s=%.1f speed=%.2f seek_ms=%.1f frames=%" G_GUINT64_FORMAT
+              " bytes=%" G_GUINT64_FORMAT " throughput_mbps=%.1f\n",
+              playback.file.c_str(), playback.position(), playback.speed(), playback.seekMs.load(),
+              playback.frames.load(), playback.bytes.load(), playback.throughputMbps());
+    if (!replay.path.empty())
+      g_print("replay frames=%" G_GUINT64_FORMAT " loops=%" G_GUINT64_FORMAT " fast=%d\n", replay.frames.load(),
+              replay.loops.load(), replay.fast);
+    if (previewScale)
+      printTranscodedStats("preview scale=" + std::to_string(previewScale) + " quality=" +
+                               std::to_string(previewQuality),
+                           preview, previewClients.size());
+    for (auto const &c : clients)
+      if (c.roiStream)
+        printTranscodedStats("roi client=" + c.toString() + " region=" + c.roi.toString(),
+                             roiStreams[c.roiStream]->stream, 1);
+    for (int i = 0; qualityTiers && i < (int)G_N_ELEMENTS(QUALITY_TIERS); i++) {
+      size_t tierClients =
+          std::count_if(clients.begin(), clients.end(), [i](const Client &c) { return c.tier == i + 1; });
+      printTranscodedStats(std::string("tier name=") + QUALITY_TIERS[i].name + " quality=" +
+                               std::to_string(QUALITY_TIERS[i].quality),
+                           tierStreams[i], tierClients);
+    }
+#ifdef HAVE_LIBJPEG
+    guint64 decodes = frameCacheStats.decodes + frameCacheStats.failures;
+    g_print("decode decodes=%" G_GUINT64_FORMAT " cache_hits=%" G_GUINT64_FORMAT " failures=%" G_GUINT64_FORMAT
+            " decode_ms_avg=%.2f\n",
+            frameCacheStats.decodes.load(), frameCacheStats.hits.load(), frameCacheStats.failures.load(),
+            decodes ? frameCacheStats.decodeNs / 1e6 / decodes : 0.0);
+#endif
+    if (idlePark != IDLE_PARK_OFF) {
+      std::lock_guard<std::mutex> lock(parkMutex);
+      double parkedTotal = parkedSeconds;
+      if (parked)
+        parkedTotal += std::chrono::duration<double>(std::chrono::steady_clock::now() - parkedAt).count();
+      g_print("idle parked=%d parked_s=%.1f\n", parked, parkedTotal);
+    }
+#ifdef OS_LINUX
+    if (!shm.socketPath.empty())
+      g_print("shm consumers=%zu published=%" G_GUINT64_FORMAT " oversized=%" G_GUINT64_FORMAT "\n",
+              shm.consumerCount(), shm.published.load(), shm.oversized.load());
+#endif
+    if (dedupe)
+      g_print("dedupe duplicates=%" G_GUINT64_FORMAT " skipped=%" G_GUINT64_FORMAT
+              " bytes_saved=%" G_GUINT64_FORMAT "\n",
+              duplicates.load(), duplicatesSkipped.load(), duplicateBytesSaved.load());
+  }
+
+  void printTranscodedStats(const std::string &label, TranscodedStream &stream, size_t clientCount) {
+    guint64 frames = stream.frames;
+    guint64 transcoded = frames + stream.failed;
+    // output size relative to the camera frames, the bitrate saved on each client
+    double ratio = stream.bytesIn ? (double)stream.bytesOut / stream.bytesIn : 0.0;
+    g_print("%s clients=%zu frames=%" G_GUINT64_FORMAT " skipped=%" G_GUINT64_FORMAT " failed=%" G_GUINT64_FORMAT
+            " bytes_avg=%.0f bytes_ratio=%.2f cpu_ms_avg=%.2f\n",
+            label.c_str(), clientCount, frames, stream.skipped.load(), stream.failed.load(),
+            frames ? (double)stream.bytesOut / frames : 0.0, ratio, transcoded ? stream.cpuNs / 1e6 / transcoded : 0.0);
+  }
+
+#ifdef HAVE_LIBJPEG
+  // Time the requantization of the most recent frame against a full decode and encode to the same quality
+  bool benchmarkTranscode(int quality, int iterations) {
+    GstBuffer *frame = NULL;
+    {
+      std::lock_guard<std::mutex> lock(lastFrameMutex);
+      if (lastFrame)
+        frame = gst_buffer_ref(lastFrame);
+    }
+    if (!frame)
+      return false;
+    GstMapInfo map;
+    if (!gst_buffer_map(frame, &map, GST_MAP_READ)) {
+      gst_buffer_unref(frame);
+      return false;
+    }
+    // a step that fails stops its loop, the times are per completed run
+    std::vector<uint8_t> requantized, reencoded;
+    int requantizeRuns = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (requantizeRuns < iterations && requantizeJpeg(map.data, map.size, quality, requantized))
+      requantizeRuns++;
+    double requantizeMs = requantizeRuns ? elapsedMs(start) / requantizeRuns : 0;
+    int reencodeRuns = 0;
+    DecodedFrame decoded;
+    start = std::chrono::steady_clock::now();
+    while (reencodeRuns < iterations && decodeJpeg(map.data, map.size, 1, DECODED_YCBCR, decoded) &&
+           encodeJpeg(decoded, quality, reencoded))
+      reencodeRuns++;
+    double reencodeMs = reencodeRuns ? elapsedMs(start) / reencodeRuns : 0;
+    // the center quarter of the frame, as a gimbal centered region of interest, sized from the decoded frame
+    std::vector<uint8_t> cropped;
+    Roi roi;
+    int cropRuns = 0;
+    start = std::chrono::steady_clock::now();
+    while (reencodeRuns && cropRuns < iterations) {
+      roi.x = decoded.width / 4;
+      roi.y = decoded.height / 4;
+      roi.width = decoded.width / 2;
+      roi.height = decoded.height / 2;
+      if (!cropJpeg(map.data, map.size, roi.x, roi.y, roi.width, roi.height, cropped))
+        break;
+      cropRuns++;
+    }
+    double cropMs = cropRuns ? elapsedMs(start) / cropRuns : 0;
+    bool ok = requantizeRuns && reencodeRuns;
+    if (ok)
+      g_print("transcode quality=%d source_bytes=%zu requantize_runs=%d requantize_ms=%.2f requantize_bytes=%zu "
+              "decode_encode_runs=%d decode_encode_ms=%.2f decode_encode_bytes=%zu\n",
+              quality, map.size, requantizeRuns, requantizeMs, requantized.size(), reencodeRuns, reencodeMs,
+              reencoded.size());
+    if (cropRuns)
+      g_print("crop region=%s crop_runs=%d crop_ms=%.2f crop_bytes=%zu\n", roi.toString().c_str(), cropRuns, cropMs,
+              cropped.size());
+    gst_buffer_unmap(frame, &map);
+    gst_buffer_unref(frame);
+    return ok;
+  }
+#endif
 
   // pipline utils
   GstBus *getBus() { return gst_element_get_bus(pipeline); }
 
-  // client utils
-  bool addClient(Client client) {
-    // check if client already exists
-    for (auto c : clients)
-      if (c == client)
+  // client utils, preview clients receive the preview stream instead of the full one
+  bool addClient(Client client, bool preview = false) {
+    {
+      std::lock_guard<std::recursive_mutex> lock(clientsMutex);
+      auto &list = preview ? previewClients : clients;
+      // check if client already exists
+      for (auto c : list)
+        if (c == client)
+          return false;
+      if (client.hostname) {
+        auto cached = dnsCache.find(client.host);
+        if (cached != dnsCache.end() && !cached->second.ip.empty())
+          client.setAddress(cached->second.ip);
+        if (cached == dnsCache.end() || cached->second.expiry <= std::chrono::steady_clock::now())
+          resolveHost(client.host);
+      }
+      list.push_back(client);
+      if (preview)
+        updatePreviewClients();
+      else
+        updateClients();
+    }
+    // outside the clients lock, the demand check takes it after the park lock
+    updateDemand();
+    return true;
+  }
+  bool setClientTier(Client client, int tier) {
+    std::lock_guard<std::recursive_mutex> lock(clientsMutex);
+    auto c = std::find(clients.begin(), clients.end(), client);
+    if (c == clients.end())
+      return false;
+    c->tier = tier;
+    updateClients();
+    return true;
+  }
+  // Streams a recording to the clients instead of the camera from start seconds at speed times realtime, 0 as fast
+  // as it can be read. Replaying the file that is already playing only seeks.
+  bool startPlayback(const std::string &file, double start, double speed) {
+    std::lock_guard<std::recursive_mutex> lock(clientsMutex);
+    if (playback.running() && playback.file != file)
+      stopPlayback();
+    if (!playback.running()) {
+      if (playback.init(file, payloaderFactory(), [this]() { stopPlayback(); }))
         return false;
-    clients.push_back(client);
+      g_object_set(G_OBJECT(playback.udpSink), "auto-multicast", true, NULL);
+      if (multicast) {
+        g_object_set(G_OBJECT(playback.udpSink), "ttl-mc", multicastTtl, NULL);
+        if (!multicastIface.empty())
+          g_object_set(G_OBJECT(playback.udpSink), "multicast-iface", multicastIface.c_str(), NULL);
+      }
+      updateClients();
+    }
+    playback.start(start, speed);
+    return true;
+  }
+  void stopPlayback() {
+    std::lock_guard<std::recursive_mutex> lock(clientsMutex);
+    if (!playback.running())
+      return;
+    playback.stop();
+    updateClients();
+    g_print("Clients back on the camera\n");
+  }
+  // crop the stream of a client to roi, an empty roi sends the whole frame again
+  bool setClientRoi(Client client, Roi roi) {
+    std::lock_guard<std::recursive_mutex> lock(clientsMutex);
+    auto c = std::find(clients.begin(), clients.end(), client);
+    if (c == clients.end())
+      return false;
+    if (roi.empty()) {
+      removeRoiStream(c->roiStream);
+      c->roiStream = 0;
+    } else if (c->roiStream) {
+      // moving the region only changes what the next frame is cropped to
+      RoiStream *roiStream = roiStreams[c->roiStream].get();
+      std::lock_guard<std::mutex> roiLock(roiStream->mutex);
+      roiStream->roi = roi;
+    } else {
+      c->roiStream = addRoiStream(roi);
+      if (!c->roiStream)
+        return false;
+    }
+    c->roi = roi;
     updateClients();
     return true;
   }
-  bool removeClient(Client client) {
-    auto old_size = clients.size();
-    clients.erase(std::remove(clients.begin(), clients.end(), client), clients.end());
-    auto changed = clients.size() != old_size;
-    if (changed)
+  bool removeClient(Client client, bool preview = false) {
+    std::lock_guard<std::recursive_mutex> lock(clientsMutex);
+    auto &list = preview ? previewClients : clients;
+    for (auto const &c : list)
+      if (c == client && c.roiStream)
+        removeRoiStream(c.roiStream);
+    auto old_size = list.size();
+    list.erase(std::remove(list.begin(), list.end(), client), list.end());
+    auto changed = list.size() != old_size;
+    if (changed && preview)
+      updatePreviewClients();
+    else if (changed)
       updateClients();
     return changed;
   }
 
+  // look up every hostname in use whose cached address expired, so clients follow DNS changes
+  void refreshHosts() {
+    std::lock_guard<std::recursive_mutex> lock(clientsMutex);
+    auto now = std::chrono::steady_clock::now();
+    for (auto const *list : {&clients, &previewClients}) {
+      for (auto const &c : *list) {
+        if (!c.hostname)
+          continue;
+        auto cached = dnsCache.find(c.host);
+        if (cached == dnsCache.end() || cached->second.expiry <= now)
+          resolveHost(c.host);
+      }
+    }
+  }
+
 private:
+  // a new stream added to the running pipeline, the id to keep in the client or 0 if it could not be created
+  int addRoiStream(Roi roi) {
+#ifdef HAVE_LIBJPEG
+    if (!pipeline)
+      return 0;
+    auto roiStream = new RoiStream();
+    int id = nextRoiStream++;
+    roiStream->roi = roi;
+    roiStream->stream.name = "roi" + std::to_string(id);
+    roiStream->stream.transcode = [roiStream](GstBuffer *frame, std::vector<uint8_t> &jpeg) {
+      Roi roi;
+      {
+        std::lock_guard<std::mutex> lock(roiStream->mutex);
+        roi = roiStream->roi;
+      }
+      GstMapInfo map;
+      if (!gst_buffer_map(frame, &map, GST_MAP_READ))
+        return false;
+      bool cropped = cropJpeg(map.data, map.size, roi.x, roi.y, roi.width, roi.height, jpeg);
+      gst_buffer_unmap(frame, &map);
+      // the payloader signals the size from the caps, which follow the region as it moves
+      roiStream->stream.width = roi.width;
+      roiStream->stream.height = roi.height;
+      return cropped;
+    };
+    if (roiStream->stream.init(pipeline, videoTee, payloaderFactory())) {
+      delete roiStream;
+      return 0;
+    }
+    roiStreams[id].reset(roiStream);
+    return id;
+#else
+    return 0;
+#endif
+  }
+  void removeRoiStream(int id) {
+    auto found = roiStreams.find(id);
+    if (found == roiStreams.end())
+      return;
+    RoiStream *roiStream = found->second.release();
+    roiStreams.erase(found);
+    roiStream->stream.remove([roiStream]() { delete roiStream; });
+  }
+
+  struct HostLookup {
+    CameraData *camera;
+    std::string host;
+  };
+
+  // Resolve in GResolver's worker threads, the result is delivered on the main loop. Neither the input thread nor
+  // the streaming threads ever wait on DNS, and a name is only looked up once however many clients use it.
+  void resolveHost(const std::string &host) {
+    auto &cached = dnsCache[host];
+    if (cached.pending)
+      return;
+    cached.pending = true;
+    GResolver *resolver = g_resolver_get_default();
+    g_resolver_lookup_by_name_async(resolver, host.c_str(), NULL, resolve_cb, new HostLookup{this, host});
+    g_object_unref(resolver);
+  }
+  static void resolve_cb(GObject *source, GAsyncResult *result, gpointer user_data) {
+    auto lookup = static_cast<HostLookup *>(user_data);
+    GError *error = NULL;
+    GList *addresses = g_resolver_lookup_by_name_finish(G_RESOLVER(source), result, &error);
+    std::string ip;
+    if (addresses) {
+      // the resolver sorts the addresses by preference, link-local ones can not be served (see isScopedAddress)
+      for (GList *a = addresses; a && ip.empty(); a = a->next) {
+        if (g_inet_address_get_is_link_local(G_INET_ADDRESS(a->data)))
+          continue;
+        gchar *address = g_inet_address_to_string(G_INET_ADDRESS(a->data));
+        ip = address;
+        g_free(address);
+      }
+      if (ip.empty())
+        g_printerr("%s only resolves to link-local IPv6 addresses, which are not supported\n", lookup->host.c_str());
+      g_resolver_free_addresses(addresses);
+    } else {
+      g_printerr("Could not resolve %s: %s\n", lookup->host.c_str(), error->message);
+      g_error_free(error);
+    }
+    lookup->camera->hostResolved(lookup->host, ip);
+    delete lookup;
+  }
+  void hostResolved(const std::string &host, const std::string &ip) {
+    std::lock_guard<std::recursive_mutex> lock(clientsMutex);
+    auto &cached = dnsCache[host];
+    cached.pending = false;
+    // failed lookups keep the last known address and are retried after the ttl
+    cached.expiry = std::chrono::steady_clock::now() + std::chrono::seconds(dnsTtl);
+    if (ip.empty() || ip == cached.ip)
+      return;
+    cached.ip = ip;
+    for (auto *list : {&clients, &previewClients})
+      for (auto &c : *list)
+        if (c.hostname && c.host == host)
+          c.setAddress(ip);
+    updateClients();
+    updatePreviewClients();
+  }
+
+  void setUserPaused() {
+    std::lock_guard<std::mutex> lock(parkMutex);
+    userPaused = true;
+    if (parked) {
+      parkedSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - parkedAt).count();
+      parked = false;
+    }
+  }
+  // called with parkMutex held
+  void unpark() {
+    parkedSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - parkedAt).count();
+    parked = false;
+    watchFirstBuffer(videoTee, "sink", "Resuming capture", false);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+  }
+
+  static gboolean recover_cb(gpointer user_data) {
+    auto self = static_cast<CameraData *>(user_data);
+    self->recoverTimer = 0;
+    // recovered once a frame passes the caps filter again, an attempt that fails posts another error
+    watchFirstBuffer(self->sourceFilter, "src", "", false, [self](double ms) { self->recovered(ms); },
+                     self->failedAt);
+    if (self->recoverPipeline) {
+      // the restart flushes the record branch, a recording still draining will not get its EOS any more
+      self->finishRecordDrain();
+      gst_element_set_state(self->pipeline, GST_STATE_NULL);
+      gst_element_set_state(self->pipeline, GST_STATE_PLAYING);
+    } else {
+      gst_element_set_state(self->source, GST_STATE_NULL);
+      gst_element_sync_state_with_parent(self->source);
+    }
+    return G_SOURCE_REMOVE;
+  }
+  void recovered(double ms) {
+    // every attempt watches for the first frame, only the first one to see it counts
+    if (recoverAttempts == 0)
+      return;
+    g_print("Recovered in %.1f ms after %d attempt%s\n", ms, recoverAttempts, recoverAttempts > 1 ? "s" : "");
+    recoveries++;
+    lastRecoverMs = ms;
+    recoverAttempts = 0;
+    if (recoverWasRecording && recording) {
+      std::string segment = recordName + "_" + std::to_string(++recordSegment);
+      g_print("Recording continues in %s.mkv\n", segment.c_str());
+      openRecordFile(segment);
+    }
+  }
+  // a failing source sends EOS after its error, which would end every output before the source is restarted. A
+  // camera never ends otherwise, a replay that does not loop does.
+  static GstPadProbeReturn source_eos_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    auto self = static_cast<CameraData *>(user_data);
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_EOS && self->recover && self->replay.path.empty())
+      return GST_PAD_PROBE_DROP;
+    return GST_PAD_PROBE_OK;
+  }
+  static GstBusSyncReply stream_status_cb(GstBus *bus, GstMessage *message, gpointer user_data) {
+    if (GST_MESSAGE_TYPE(message) != GST_MESSAGE_STREAM_STATUS)
+      return GST_BUS_PASS;
+    GstStreamStatusType type;
+    GstElement *owner;
+    gst_message_parse_stream_status(message, &type, &owner);
+    if (type != GST_STREAM_STATUS_TYPE_ENTER)
+      return GST_BUS_PASS;
+    auto role = THREAD_ROLES.find(GST_ELEMENT_NAME(owner));
+    if (role != THREAD_ROLES.end())
+      static_cast<CameraData *>(user_data)->configureThread(role->second);
+    return GST_BUS_PASS;
+  }
+  // runs on the streaming thread itself. Threads are named after their role so they can be told apart in top -H,
+  // the capture and network threads can be pinned to their own cores and run SCHED_FIFO so logging and disk flushes
+  // can not preempt them.
+  void configureThread(const std::string &role) {
+#ifdef OS_LINUX
+    pthread_setname_np(pthread_self(), ("cam-" + role).c_str());
+    auto profile = threadProfiles.find(role);
+    if (profile == threadProfiles.end())
+      return;
+    if (!profile->second.cpus.empty()) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      for (int cpu : profile->second.cpus)
+        CPU_SET(cpu, &cpus);
+      if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+        g_printerr("Could not set the cpu affinity of the %s thread\n", role.c_str());
+    }
+    if (profile->second.priority > 0) {
+      sched_param param = {};
+      param.sched_priority = profile->second.priority;
+      if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+        g_printerr("Could not run the %s thread with SCHED_FIFO priority %d, this needs CAP_SYS_NICE\n",
+                   role.c_str(), profile->second.priority);
+    }
+#endif
+  }
+
+  // age of the frame against the pipeline clock, the buffer timestamp is the capture time in running time
+  static GstPadProbeReturn deadline_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    auto self = static_cast<CameraData *>(user_data);
+    GstBuffer *frame = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstClock *clock = gst_element_get_clock(self->pipeline);
+    if (!clock || !GST_BUFFER_PTS_IS_VALID(frame)) {
+      if (clock)
+        gst_object_unref(clock);
+      return GST_PAD_PROBE_OK;
+    }
+    GstClockTime now = gst_clock_get_time(clock);
+    gst_object_unref(clock);
+    GstClockTime captured = gst_element_get_base_time(self->pipeline) + GST_BUFFER_PTS(frame);
+    double ageMs = now > captured ? (double)(now - captured) / GST_MSECOND : 0;
+    std::lock_guard<std::mutex> lock(self->sendStats.mutex);
+    if (self->deadlineMs > 0 && ageMs > self->deadlineMs) {
+      self->sendStats.late++;
+      return GST_PAD_PROBE_DROP;
+    }
+    self->sendStats.record(ageMs, now);
+    return GST_PAD_PROBE_OK;
+  }
+  static void rtp_overrun_cb(GstElement *queue, gpointer user_data) {
+    auto self = static_cast<CameraData *>(user_data);
+    std::lock_guard<std::mutex> lock(self->sendStats.mutex);
+    self->sendStats.overrun++;
+  }
+
+  static GstPadProbeReturn validate_frame_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    auto self = static_cast<CameraData *>(user_data);
+    GstBuffer *frame = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstMapInfo map;
+    if (!gst_buffer_map(frame, &map, GST_MAP_READ))
+      return GST_PAD_PROBE_OK;
+    auto start = std::chrono::steady_clock::now();
+    JpegFrameStatus status = validateJpegFrame(map.data, map.size);
+    self->validateNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start)
+                            .count();
+    gst_buffer_unmap(frame, &map);
+    self->frameStatus[status]++;
+    if (status == JPEG_FRAME_OK || self->corruptFrames == CORRUPT_PASS)
+      return GST_PAD_PROBE_OK;
+    if (self->corruptFrames == CORRUPT_DROP)
+      return GST_PAD_PROBE_DROP;
+    frame = gst_buffer_make_writable(frame);
+    GST_BUFFER_FLAG_SET(frame, GST_BUFFER_FLAG_CORRUPTED);
+    GST_PAD_PROBE_INFO_DATA(info) = frame;
+    return GST_PAD_PROBE_OK;
+  }
+
+  // runs before last_frame_cb, so lastFrame is still the previous frame. Identical frames have the same size, so only
+  // frames matching in size are compared at all, and the compare stops at the first differing byte.
+  static GstPadProbeReturn duplicate_frame_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    auto self = static_cast<CameraData *>(user_data);
+    GstBuffer *frame = GST_PAD_PROBE_INFO_BUFFER(info);
+    bool duplicate = false;
+    {
+      std::lock_guard<std::mutex> lock(self->lastFrameMutex);
+      GstMapInfo current, previous;
+      if (self->lastFrame && gst_buffer_get_size(self->lastFrame) == gst_buffer_get_size(frame) &&
+          gst_buffer_map(frame, &current, GST_MAP_READ)) {
+        if (gst_buffer_map(self->lastFrame, &previous, GST_MAP_READ)) {
+          duplicate = memcmp(current.data, previous.data, current.size) == 0;
+          gst_buffer_unmap(self->lastFrame, &previous);
+        }
+        gst_buffer_unmap(frame, &current);
+      }
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (duplicate) {
+      self->duplicates++;
+      if (now - self->lastForwardedFrame < std::chrono::seconds(1)) {
+        self->duplicatesSkipped++;
+        self->duplicateBytesSaved += gst_buffer_get_size(frame);
+        return GST_PAD_PROBE_DROP;
+      }
+    }
+    self->lastForwardedFrame = now;
+    return GST_PAD_PROBE_OK;
+  }
+
+#ifdef OS_LINUX
+  static GstPadProbeReturn shm_frame_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    auto self = static_cast<CameraData *>(user_data);
+    GstBuffer *frame = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstMapInfo map;
+    if (gst_buffer_map(frame, &map, GST_MAP_READ)) {
+      self->shm.publish(map.data, map.size, GST_BUFFER_PTS(frame));
+      gst_buffer_unmap(frame, &map);
+    }
+    return GST_PAD_PROBE_OK;
+  }
+#endif
+
+#ifdef HAVE_LIBJPEG
+  static GstPadProbeReturn decode_consumer_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    getDecodedFrame(GST_PAD_PROBE_INFO_BUFFER(info), 1, DECODED_RGB);
+    return GST_PAD_PROBE_OK;
+  }
+#endif
+
+  static GstPadProbeReturn last_frame_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    auto self = static_cast<CameraData *>(user_data);
+    GstBuffer *frame = gst_buffer_ref(GST_PAD_PROBE_INFO_BUFFER(info));
+    GstBuffer *old;
+    {
+      std::lock_guard<std::mutex> lock(self->lastFrameMutex);
+      old = self->lastFrame;
+      self->lastFrame = frame;
+    }
+    if (old)
+      gst_buffer_unref(old);
+    return GST_PAD_PROBE_OK;
+  }
+#ifdef HAVE_RTSP_SERVER
+  static GstFlowReturn rtsp_sample_cb(GstAppSink *sink, gpointer user_data) {
+    auto self = static_cast<CameraData *>(user_data);
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+    if (!sample)
+      return GST_FLOW_OK;
+    GstElement *src = NULL;
+    {
+      std::lock_guard<std::mutex> lock(self->rtspMutex);
+      if (self->rtspSrc)
+        src = GST_ELEMENT(gst_object_ref(self->rtspSrc));
+    }
+    if (src) {
+      GstCaps *caps = gst_sample_get_caps(sample);
+      GstCaps *current = gst_app_src_get_caps(GST_APP_SRC(src));
+      if (caps && (!current || !gst_caps_is_equal(current, caps)))
+        gst_app_src_set_caps(GST_APP_SRC(src), caps);
+      if (current)
+        gst_caps_unref(current);
+      // shares the memory, only the timestamps are dropped so the media pipeline stamps them with its own clock
+      GstBuffer *buffer = gst_buffer_copy(gst_sample_get_buffer(sample));
+      GST_BUFFER_PTS(buffer) = GST_CLOCK_TIME_NONE;
+      GST_BUFFER_DTS(buffer) = GST_CLOCK_TIME_NONE;
+      gst_app_src_push_buffer(GST_APP_SRC(src), buffer);
+      gst_object_unref(src);
+    }
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+  }
+  static void rtsp_media_configure_cb(GstRTSPMediaFactory *factory, GstRTSPMedia *media, gpointer user_data) {
+    auto self = static_cast<CameraData *>(user_data);
+    GstElement *element = gst_rtsp_media_get_element(media);
+    GstElement *src = gst_bin_get_by_name_recurse_up(GST_BIN(element), "rtspSrc");
+    gst_object_unref(element);
+    {
+      std::lock_guard<std::mutex> lock(self->rtspMutex);
+      if (self->rtspSrc)
+        gst_object_unref(self->rtspSrc);
+      self->rtspSrc = src;
+    }
+    g_signal_connect(media, "unprepared", G_CALLBACK(rtsp_media_unprepared_cb), self);
+  }
+  static void rtsp_media_unprepared_cb(GstRTSPMedia *media, gpointer user_data) {
+    auto self = static_cast<CameraData *>(user_data);
+    std::lock_guard<std::mutex> lock(self->rtspMutex);
+    if (self->rtspSrc)
+      gst_object_unref(self->rtspSrc);
+    self->rtspSrc = NULL;
+  }
+  static void rtsp_client_connected_cb(GstRTSPServer *server, GstRTSPClient *client, gpointer user_data) {
+    GstRTSPConnection *connection = gst_rtsp_client_get_connection(client);
+    g_print("RTSP client connected from %s\n", gst_rtsp_connection_get_ip(connection));
+  }
+#endif
+  void logSrtConnection(const GstStructure *stats) {
+    static const char *fields[] = {"rtt-ms",         "packets-sent",         "packets-sent-lost",
+                                   "packets-retransmitted", "packets-sent-dropped", "bytes-sent",
+                                   "send-rate-mbps", "bandwidth-mbps",       "negotiated-latency-ms"};
+    std::string line = "srt";
+    const GValue *address = gst_structure_get_value(stats, "caller-address");
+    if (address && G_VALUE_HOLDS_OBJECT(address)) {
+      gchar *host = g_inet_address_to_string(
+          g_inet_socket_address_get_address(G_INET_SOCKET_ADDRESS(g_value_get_object(address))));
+      line += std::string(" peer=") + host;
+      g_free(host);
+    }
+    for (auto field : fields) {
+      const GValue *value = gst_structure_get_value(stats, field);
+      if (!value)
+        continue;
+      gchar *serialized = gst_value_serialize(value);
+      line += std::string(" ") + field + "=" + serialized;
+      g_free(serialized);
+    }
+    g_print("%s\n", line.c_str());
+  }
+  void configureSource(GstElement *element) {
+#ifdef OS_LINUX
+    g_object_set(G_OBJECT(element), "device", cameraPath.c_str(), NULL);
+    g_object_set(G_OBJECT(element), "io-mode", 2, NULL);
+#elif OS_WINDOWS
+    g_object_set(G_OBJECT(element), "device-path", cameraPath.c_str(), NULL);
+#endif
+  }
+  std::string deviceIdentity() {
+#ifdef OS_LINUX
+    // the path can change between boots, the driver, card and usb port can not
+    int fd = open(cameraPath.c_str(), O_RDONLY);
+    if (fd >= 0) {
+      v4l2_capability cap = {};
+      int ret = ioctl(fd, VIDIOC_QUERYCAP, &cap);
+      close(fd);
+      if (ret == 0)
+        return std::string((char *)cap.driver) + "-" + (char *)cap.card + "-" + (char *)cap.bus_info + "-" +
+               std::to_string(cap.version);
+    }
+#endif
+    return cameraPath;
+  }
+  GstCaps *probeCaps() {
+    GstElement *probe = gst_element_factory_make(VIDEO_SOURCE, NULL);
+    if (!probe)
+      return NULL;
+    configureSource(probe);
+    GstCaps *caps = NULL;
+    if (gst_element_set_state(probe, GST_STATE_READY) != GST_STATE_CHANGE_FAILURE) {
+      GstPad *pad = gst_element_get_static_pad(probe, "src");
+      caps = gst_pad_query_caps(pad, NULL);
+      gst_object_unref(pad);
+    }
+    gst_element_set_state(probe, GST_STATE_NULL);
+    gst_object_unref(probe);
+    if (caps && gst_caps_is_any(caps)) {
+      gst_caps_unref(caps);
+      return NULL;
+    }
+    return caps;
+  }
+  GstCaps *modeCaps(int modeWidth, int modeHeight, int modeFramerate) {
+    return gst_caps_new_simple("image/jpeg",                                     //
+                               "width", G_TYPE_INT, modeWidth,                   //
+                               "height", G_TYPE_INT, modeHeight,                 //
+                               "framerate", GST_TYPE_FRACTION, modeFramerate, 1, //
+                               "format", G_TYPE_STRING, "MJPG",                  //
+                               NULL);
+  }
+  void updateCaps() {
+    // a recording plays in the mode it was made in
+    if (!replay.path.empty()) {
+      GstCaps *replayCaps = gst_caps_new_empty_simple("image/jpeg");
+      g_object_set(G_OBJECT(sourceFilter), "caps", replayCaps, NULL);
+      gst_caps_unref(replayCaps);
+      return;
+    }
+    GstCaps *filtercaps = modeCaps(width, height, framerate);
+    if (supportedCaps) {
+      // pin every field the camera reports (colorimetry, pixel-aspect-ratio, ...) so negotiation has nothing to
+      // fixate
+      GstCaps *pinned = gst_caps_intersect(supportedCaps, filtercaps);
+      if (!gst_caps_is_empty(pinned)) {
+        gst_caps_unref(filtercaps);
+        filtercaps = gst_caps_fixate(pinned);
+      } else {
+        gst_caps_unref(pinned);
+      }
+    }
+    g_object_set(G_OBJECT(sourceFilter), "caps", filtercaps, NULL);
+    gst_caps_unref(filtercaps);
+  }
+  int openRecordFile(std::string filename) {
+    finishRecordDrain();
+    gst_element_set_state(fileSink, GST_STATE_NULL);
+    gst_element_set_state(mkvMux, GST_STATE_NULL);
+    g_object_set(G_OBJECT(fileSink), "location", filename.append(".mkv").c_str(), NULL);
+    recordIndex.open(filename + ".idx");
+    gst_element_set_state(fileSink, GST_STATE_PLAYING);
+    gst_element_set_state(mkvMux, GST_STATE_PLAYING);
+    gst_element_link_many(videoTee, recordQueue, NULL);
+    return 0;
+  }
+  // Matroska writes its cues and duration when it gets EOS, without them a recording can only be searched linearly.
+  // EOS is sent through the record branch and stopped at the filesink, so the rest of the pipeline never sees it.
+  // Commands from the input thread wait for it. Recovery runs on the main loop right after a failure, when the EOS is
+  // least likely to arrive, so it does not wait: the EOS or a timeout, whichever comes first, closes the file.
+  bool closeRecordFile(bool wait = true) {
+    // a recording recovery started to close is already closed
+    if (finishRecordDrain())
+      return true;
+    gst_element_unlink_many(videoTee, recordQueue, NULL);
+    auto drain = startRecordDrain(!wait);
+    if (wait) {
+      {
+        std::unique_lock<std::mutex> lock(drain->mutex);
+        if (!drain->done.wait_for(lock, std::chrono::milliseconds(RECORD_DRAIN_MS), [&]() { return drain->eos; }))
+          g_printerr("Recording did not finish in time, it is closed without its cues\n");
+      }
+      finishRecordDrain();
+    }
+    return true;
+  }
+  std::shared_ptr<RecordDrain> startRecordDrain(bool async) {
+    auto drain = std::make_shared<RecordDrain>();
+    drain->camera = this;
+    drain->async = async;
+    {
+      std::lock_guard<std::mutex> lock(drainMutex);
+      recordDrain = drain;
+      GstPad *sinkPad = gst_element_get_static_pad(fileSink, "sink");
+      // the probe holds its own reference, it can outlive a drain that timed out
+      drainProbe = gst_pad_add_probe(sinkPad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, record_eos_cb,
+                                     new std::shared_ptr<RecordDrain>(drain), deleteRecordDrain);
+      gst_object_unref(sinkPad);
+      if (async)
+        drainTimer = g_timeout_add(RECORD_DRAIN_MS, record_drain_timeout_cb, this);
+    }
+    GstPad *queuePad = gst_element_get_static_pad(recordQueue, "sink");
+    gst_pad_send_event(queuePad, gst_event_new_eos());
+    gst_object_unref(queuePad);
+    return drain;
+  }
+  // Resets the record branch for the next recording once the drain is over, false if there was none. Only the given
+  // drain is finished when one is passed, a late callback of an earlier one does nothing.
+  bool finishRecordDrain(RecordDrain *only = NULL) {
+    std::lock_guard<std::mutex> lock(drainMutex);
+    if (!recordDrain || (only && recordDrain.get() != only))
+      return false;
+    recordDrain.reset();
+    if (drainTimer)
+      g_source_remove(drainTimer);
+    drainTimer = 0;
+    GstPad *sinkPad = gst_element_get_static_pad(fileSink, "sink");
+    gst_pad_remove_probe(sinkPad, drainProbe);
+    gst_object_unref(sinkPad);
+    // the queue saw EOS too and would refuse the next recording's frames
+    gst_element_set_state(recordQueue, GST_STATE_NULL);
+    gst_element_set_state(fileSink, GST_STATE_NULL);
+    gst_element_set_state(mkvMux, GST_STATE_NULL);
+    recordIndex.close();
+    g_object_set(G_OBJECT(fileSink), "location", NULL_FILE, NULL);
+    gst_element_set_state(fileSink, GST_STATE_PLAYING);
+    gst_element_set_state(mkvMux, GST_STATE_PLAYING);
+    gst_element_set_state(recordQueue, GST_STATE_PLAYING);
+    return true;
+  }
+  static void deleteRecordDrain(gpointer data) { delete static_cast<std::shared_ptr<RecordDrain> *>(data); }
+  static GstPadProbeReturn record_eos_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) != GST_EVENT_EOS)
+      return GST_PAD_PROBE_OK;
+    auto drain = *static_cast<std::shared_ptr<RecordDrain> *>(user_data);
+    std::lock_guard<std::mutex> lock(drain->mutex);
+    drain->eos = true;
+    drain->done.notify_all();
+    if (drain->async)
+      g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, record_drained_cb, new std::shared_ptr<RecordDrain>(drain),
+                      deleteRecordDrain);
+    return GST_PAD_PROBE_DROP;
+  }
+  static gboolean record_drained_cb(gpointer user_data) {
+    auto drain = static_cast<std::shared_ptr<RecordDrain> *>(user_data)->get();
+    drain->camera->finishRecordDrain(drain);
+    return G_SOURCE_REMOVE;
+  }
+  static gboolean record_drain_timeout_cb(gpointer user_data) {
+    auto self = static_cast<CameraData *>(user_data);
+    {
+      // the source ends with this call, finishing must not remove it again
+      std::lock_guard<std::mutex> lock(self->drainMutex);
+      self->drainTimer = 0;
+    }
+    if (self->finishRecordDrain())
+      g_printerr("Recording did not finish in time, it is closed without its cues\n");
+    return G_SOURCE_REMOVE;
+  }
   void updateClients() {
-    std::string result;
-    for (auto c : clients)
-      result += c.toString() + ",";
-    result.pop_back();
-    if (udpsink)
-      g_object_set(G_OBJECT(udpsink), "clients", result.c_str(), NULL);
+    std::lock_guard<std::recursive_mutex> lock(clientsMutex);
+    std::vector<std::pair<std::string, int>> result;
+    std::vector<std::vector<std::pair<std::string, int>>> tierResults(G_N_ELEMENTS(QUALITY_TIERS));
+    std::map<int, std::vector<std::pair<std::string, int>>> roiResults;
+    // clients that support multicast are served by the single copy sent to the group
+    for (auto c : clients) {
+      if (!c.resolved)
+        continue;
+      if (c.roiStream)
+        roiResults[c.roiStream].push_back({c.ip(), c.port});
+      else if (c.tier > 0)
+        tierResults[c.tier - 1].push_back({c.ip(), c.port});
+      else if (!multicast || !c.multicast)
+        result.push_back({c.ip(), c.port});
+    }
+    if (multicast)
+      result.push_back({multicastGroup.ip(), multicastGroup.port});
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    destinations = result.size();
+    // a recording playing back replaces the camera for the full quality clients
+    if (playback.running()) {
+      setSinkDestinations(playback.udpSink, result, playback.destinations);
+      setSinkDestinations(udpsink, {}, sinkDestinations);
+    } else {
+      setSinkDestinations(udpsink, result, sinkDestinations);
+    }
+    for (size_t i = 0; i < tierResults.size(); i++) {
+      std::sort(tierResults[i].begin(), tierResults[i].end());
+      tierResults[i].erase(std::unique(tierResults[i].begin(), tierResults[i].end()), tierResults[i].end());
+      destinations += tierResults[i].size();
+      setSinkDestinations(tierStreams[i].udpSink, tierResults[i], tierStreams[i].destinations);
+      tierStreams[i].active = !tierResults[i].empty();
+    }
+    for (auto &r : roiStreams) {
+      auto &result = roiResults[r.first];
+      destinations += result.size();
+      setSinkDestinations(r.second->stream.udpSink, result, r.second->stream.destinations);
+      r.second->stream.active = !result.empty();
+    }
+  }
+  void updatePreviewClients() {
+    std::lock_guard<std::recursive_mutex> lock(clientsMutex);
+    std::vector<std::pair<std::string, int>> result;
+    for (auto c : previewClients)
+      if (c.resolved)
+        result.push_back({c.ip(), c.port});
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    setSinkDestinations(preview.udpSink, result, preview.destinations);
+    preview.active = !result.empty();
+  }
+  // multiudpsink keeps separate IPv4 and IPv6 sockets and picks one per destination, only the difference is applied
+  // so the other destinations never miss a packet
+  void setSinkDestinations(GstElement *sink, const std::vector<std::pair<std::string, int>> &result,
+                           std::vector<std::pair<std::string, int>> &current) {
+    if (!sink)
+      return;
+    for (auto const &d : current)
+      if (std::find(result.begin(), result.end(), d) == result.end())
+        g_signal_emit_by_name(sink, "remove", d.first.c_str(), d.second);
+    for (auto const &d : result)
+      if (std::find(current.begin(), current.end(), d) == current.end())
+        g_signal_emit_by_name(sink, "add", d.first.c_str(), d.second);
+    current = result;
   }
 };
 
@@ -265,6 +2033,19 @@ void inputLoop(CameraData *camera) {
     std::transform(args[0].begin(), args[0].end(), args[0].begin(), ::tolower);
     if (args[0] == "help") {
       std::cout << "Available commands:" << std::endl;
+      std::cout << "  play | pause | stop" << std::endl;
+      std::cout << "  addclient <host> <port> [mcast] [tier] | removeclient <host> <port>" << std::endl;
+      std::cout << "  settier <host> <port> <full|high|medium|low>" << std::endl;
+      std::cout << "  roi <host> <port> <x> <y> <width> <height> | roi <host> <port> off" << std::endl;
+      std::cout << "  addpreview <host> <port> | removepreview <host> <port>" << std::endl;
+      std::cout << "  record <filename> | stoprecord" << std::endl;
+      std::cout << "  setmode <width>x<height> <framerate>" << std::endl;
+      std::cout << "  snapshot <filename>" << std::endl;
+      std::cout << "  replay <file.mkv> [start seconds] [speed] | stopreplay" << std::endl;
+      std::cout << "  export <file.mkv> <t0> <t1> <output.mkv> [remux]" << std::endl;
+      std::cout << "  injecterror [source|pipeline]" << std::endl;
+      std::cout << "  stats | benchtranscode [quality]" << std::endl;
+      std::cout << "  exit" << std::endl;
     } else if (args[0] == "play") {
       camera->play();
     } else if (args[0] == "pause") {
@@ -272,17 +2053,132 @@ void inputLoop(CameraData *camera) {
     } else if (args[0] == "stop") {
       camera->stop();
     } else if (args[0] == "addclient") {
-      if (args.size() != 3) {
-        std::cout << "Usage: addclient <ip> <port>" << std::endl;
+      bool multicast = false;
+      int tier = 0;
+      bool valid = args.size() >= 3 && args.size() <= 5;
+      for (size_t i = 3; valid && i < args.size(); i++) {
+        if (args[i] == "mcast")
+          multicast = true;
+        else
+          valid = (tier = parseTier(args[i])) >= 0;
+      }
+      if (!valid) {
+        std::cout << "Usage: addclient <host> <port> [mcast] [full|high|medium|low]" << std::endl;
+        continue;
+      }
+      if (tier && !camera->qualityTiers) {
+        std::cout << "Quality tiers not enabled, start with --quality-tiers" << std::endl;
+        continue;
+      }
+      Client client(args[1], std::stoi(args[2]), multicast);
+      client.tier = tier;
+      if (isScopedAddress(client.host)) {
+        std::cout << "Link-local IPv6 addresses are not supported: " << args[1] << std::endl;
         continue;
       }
-      camera->addClient(Client(args[1], std::stoi(args[2])));
+      if (client.hostname && !isHostname(client.host)) {
+        std::cout << "Invalid host: " << args[1] << std::endl;
+        continue;
+      }
+      camera->addClient(client);
+      if (multicast && !tier && camera->multicast)
+        std::cout << "Client served by multicast group " << camera->multicastGroup.toString() << std::endl;
     } else if (args[0] == "removeclient") {
       if (args.size() != 3) {
-        std::cout << "Usage: removeclient <ip> <port>" << std::endl;
+        std::cout << "Usage: removeclient <host> <port>" << std::endl;
         continue;
       }
       camera->removeClient(Client(args[1], std::stoi(args[2])));
+    } else if (args[0] == "settier") {
+      int tier = args.size() == 4 ? parseTier(args[3]) : -1;
+      int port = 0;
+      try {
+        if (tier >= 0)
+          port = std::stoi(args[2]);
+      } catch (std::exception &e) {
+        tier = -1;
+      }
+      if (tier < 0) {
+        std::cout << "Usage: settier <host> <port> <full|high|medium|low>" << std::endl;
+        continue;
+      }
+      if (tier && !camera->qualityTiers) {
+        std::cout << "Quality tiers not enabled, start with --quality-tiers" << std::endl;
+        continue;
+      }
+      if (!camera->setClientTier(Client(args[1], port), tier))
+        std::cout << "No such client" << std::endl;
+    } else if (args[0] == "roi") {
+      Roi roi;
+      int port = 0;
+      bool valid = args.size() == 7 || (args.size() == 4 && args[3] == "off");
+      try {
+        if (valid)
+          port = std::stoi(args[2]);
+        if (valid && args.size() == 7) {
+          roi.x = std::stoi(args[3]);
+          roi.y = std::stoi(args[4]);
+          roi.width = std::stoi(args[5]);
+          roi.height = std::stoi(args[6]);
+        }
+      } catch (std::exception &e) {
+        valid = false;
+      }
+      if (!valid || (args.size() == 7 && (roi.x < 0 || roi.y < 0 || roi.empty()))) {
+        std::cout << "Usage: roi <host> <port> <x> <y> <width> <height> | roi <host> <port> off" << std::endl;
+        continue;
+      }
+#ifndef HAVE_LIBJPEG
+      if (!roi.empty()) {
+        std::cout << "Built without libjpeg support" << std::endl;
+        continue;
+      }
+#endif
+      if (!camera->setClientRoi(Client(args[1], port), roi))
+        std::cout << "No such client" << std::endl;
+    } else if (args[0] == "benchtranscode") {
+#ifdef HAVE_LIBJPEG
+      int quality = 50;
+      try {
+        if (args.size() > 1)
+          quality = std::stoi(args[1]);
+      } catch (std::exception &e) {
+        quality = 0;
+      }
+      if (quality < 1 || quality > 100 || !camera->benchmarkTranscode(quality, 20))
+        std::cout << "Usage: benchtranscode [quality], needs a frame to have been captured" << std::endl;
+#else
+      std::cout << "Built without libjpeg support" << std::endl;
+#endif
+    } else if (args[0] == "addpreview" || args[0] == "removepreview") {
+      if (args.size() != 3) {
+        std::cout << "Usage: " << args[0] << " <host> <port>" << std::endl;
+        continue;
+      }
+      if (!camera->previewScale) {
+        std::cout << "Preview stream not enabled, start with --preview-scale" << std::endl;
+        continue;
+      }
+      int port = 0;
+      try {
+        port = std::stoi(args[2]);
+      } catch (std::exception &e) {
+        std::cout << "Usage: " << args[0] << " <host> <port>" << std::endl;
+        continue;
+      }
+      Client client(args[1], port);
+      if (isScopedAddress(client.host)) {
+        std::cout << "Link-local IPv6 addresses are not supported: " << args[1] << std::endl;
+        continue;
+      }
+      if (client.hostname && !isHostname(client.host)) {
+        std::cout << "Invalid host: " << args[1] << std::endl;
+        continue;
+      }
+      if (args[0] == "addpreview")
+        camera->addClient(client, true);
+      else
+        camera->removeClient(client, true);
     } else if (args[0] == "record") {
       if (args.size() != 2) {
         std::cout << "Usage: record <filename>" << std::endl;
@@ -299,6 +2195,97 @@ void inputLoop(CameraData *camera) {
       camera->startRecord(args[1]);
     } else if (args[0] == "stoprecord") {
       camera->stopRecord();
+    } else if (args[0] == "setmode") {
+      int width, height;
+      int framerate = 0;
+      bool valid = args.size() == 3 && parseResolution(args[1], width, height);
+      try {
+        if (valid)
+          framerate = std::stoi(args[2]);
+      } catch (std::exception &e) {
+        valid = false;
+      }
+      if (!valid || framerate <= 0) {
+        std::cout << "Usage: setmode <width>x<height> <framerate>" << std::endl;
+        continue;
+      }
+      int ret = camera->setMode(width, height, framerate);
+      if (ret > 0) {
+        std::cout << "Mode unchanged" << std::endl;
+      } else if (ret == -2) {
+        std::cout << "The mode can not be changed while replaying a recording" << std::endl;
+      } else if (ret < 0) {
+        std::cout << "Mode not supported by camera" << std::endl;
+        camera->printSupportedModes();
+      }
+    } else if (args[0] == "snapshot") {
+      if (args.size() != 2) {
+        std::cout << "Usage: snapshot <filename>" << std::endl;
+        continue;
+      }
+      auto start = std::chrono::steady_clock::now();
+      if (camera->snapshot(args[1]))
+        std::cout << "Snapshot written to " << args[1] << " in " << elapsedMs(start) << " ms" << std::endl;
+      else
+        std::cout << "Could not write snapshot" << std::endl;
+    } else if (args[0] == "replay") {
+      double start = 0;
+      double speed = 1;
+      bool valid = args.size() >= 2 && args.size() <= 4;
+      try {
+        if (valid && args.size() > 2)
+          start = std::stod(args[2]);
+        if (valid && args.size() > 3)
+          speed = std::stod(args[3]);
+      } catch (std::exception &e) {
+        valid = false;
+      }
+      if (!valid || start < 0 || speed < 0) {
+        std::cout << "Usage: replay <file.mkv> [start seconds] [speed], speed 0 sends as fast as the file is read"
+                  << std::endl;
+        continue;
+      }
+      if (!camera->startPlayback(args[1], start, speed))
+        std::cout << "Could not replay " << args[1] << std::endl;
+    } else if (args[0] == "export") {
+      double t0 = 0;
+      double t1 = 0;
+      bool valid = args.size() >= 5 && args.size() <= 6 && (args.size() == 5 || args[5] == "remux");
+      try {
+        if (valid) {
+          t0 = std::stod(args[2]);
+          t1 = std::stod(args[3]);
+        }
+      } catch (std::exception &e) {
+        valid = false;
+      }
+      if (!valid || t0 < 0 || t1 <= t0) {
+        std::cout << "Usage: export <file.mkv> <t0> <t1> <output.mkv> [remux], times in seconds from the start with "
+                     "t0 < t1. remux demuxes the file up to t1 instead of using its index, for comparison"
+                  << std::endl;
+        continue;
+      }
+      auto start = std::chrono::steady_clock::now();
+      int frames = args.size() == 6 ? remuxClip(args[1], t0, t1, args[4]) : exportClip(args[1], t0, t1, args[4]);
+      if (frames >= 0)
+        std::cout << "Exported " << frames << " frames to " << args[4] << " in " << elapsedMs(start) << " ms"
+                  << std::endl;
+      else
+        std::cout << "Could not export " << args[1] << std::endl;
+    } else if (args[0] == "injecterror") {
+      if (args.size() > 2 || (args.size() == 2 && args[1] != "source" && args[1] != "pipeline")) {
+        std::cout << "Usage: injecterror [source|pipeline]" << std::endl;
+        continue;
+      }
+      if (!camera->recover) {
+        std::cout << "Recovery not enabled, start with --recover" << std::endl;
+        continue;
+      }
+      camera->injectError(args.size() == 1 || args[1] == "source");
+    } else if (args[0] == "stopreplay") {
+      camera->stopPlayback();
+    } else if (args[0] == "stats") {
+      camera->printStats();
     } else if (args[0] == "exit") {
       break;
     } else {
@@ -311,21 +2298,41 @@ int parseArgs(cxxopts::ParseResult result, CameraData &camera) {
   if (result.count("help")) {
     return 1;
   }
-  std::string cameraPath;
-  try {
-    cameraPath = result["camera"].as<std::string>();
-  } catch (cxxopts::exceptions::option_has_no_value e) {
-    std::cout << "Camera path required" << std::endl;
-    return 1;
-  } catch (cxxopts::exceptions::exception e) {
-    std::cout << e.what() << std::endl;
-    return 1;
+  if (result.count("replay")) {
+    camera.replay.path = result["replay"].as<std::string>();
+    camera.replay.loop = result.count("replay-loop") > 0;
+    camera.replay.fast = result.count("replay-fast") > 0;
+    if (!g_file_test(camera.replay.path.c_str(), G_FILE_TEST_IS_REGULAR)) {
+      std::cout << "Replay file not found: " << camera.replay.path << std::endl;
+      return 1;
+    }
+  } else {
+    std::string cameraPath;
+    try {
+      cameraPath = result["camera"].as<std::string>();
+    } catch (cxxopts::exceptions::option_has_no_value e) {
+      std::cout << "Camera path required" << std::endl;
+      return 1;
+    } catch (cxxopts::exceptions::exception e) {
+      std::cout << e.what() << std::endl;
+      return 1;
+    }
+    camera.cameraPath = cameraPath;
+  }
+
+  // a recording plays in the mode it was made in, which its index records
+  RecordIndexHeader index;
+  if (!camera.replay.path.empty() && readRecordIndexHeader(camera.replay.path, index)) {
+    camera.width = index.width;
+    camera.height = index.height;
+    camera.framerate = index.framerateDen ? index.framerateNum / index.framerateDen : 0;
   }
-  camera.cameraPath = cameraPath;
+  bool replaying = !camera.replay.path.empty();
 
   std::string resolution;
   try {
-    resolution = result["resolution"].as<std::string>();
+    if (!replaying || result.count("resolution"))
+      resolution = result["resolution"].as<std::string>();
   } catch (cxxopts::exceptions::option_has_no_value e) {
     std::cout << "Resolution required" << std::endl;
     return 1;
@@ -333,18 +2340,15 @@ int parseArgs(cxxopts::ParseResult result, CameraData &camera) {
     std::cout << e.what() << std::endl;
     return 1;
   }
-  std::regex resRegex("([0-9]+)x([0-9]+)");
-  std::smatch resMatch;
-  if (!std::regex_match(resolution, resMatch, resRegex)) {
+  if ((!replaying || result.count("resolution")) && !parseResolution(resolution, camera.width, camera.height)) {
     std::cout << "Invalid resolution format" << std::endl;
     return 1;
   }
-  camera.width = std::stoi(resMatch[1]);
-  camera.height = std::stoi(resMatch[2]);
 
-  int framerate;
+  int framerate = camera.framerate;
   try {
-    framerate = result["framerate"].as<int>();
+    if (!replaying || result.count("framerate"))
+      framerate = result["framerate"].as<int>();
   } catch (cxxopts::exceptions::option_has_no_value e) {
     std::cout << "Framerate required" << std::endl;
     return 1;
@@ -354,6 +2358,55 @@ int parseArgs(cxxopts::ParseResult result, CameraData &camera) {
   }
   camera.framerate = framerate;
 
+  if (result.count("caps-cache"))
+    camera.capsCacheDir = result["caps-cache"].as<std::string>();
+  camera.reprobe = result.count("reprobe") > 0;
+  camera.recover = result.count("recover") > 0;
+
+  if (result.count("thumbnail"))
+    camera.thumbnailFile = result["thumbnail"].as<std::string>();
+  camera.thumbnailInterval = result["thumbnail-interval"].as<int>();
+  if (result.count("multicast")) {
+    std::string group = result["multicast"].as<std::string>();
+    std::string host;
+    int port;
+    if (!parseHostPort(group, host, port) || !Client(host, port).isMulticastGroup()) {
+      std::cout << "Invalid multicast group: " << group << std::endl;
+      return 1;
+    }
+    camera.multicast = true;
+    camera.multicastGroup = Client(host, port);
+    camera.multicastTtl = result["multicast-ttl"].as<int>();
+    if (result.count("multicast-iface"))
+      camera.multicastIface = result["multicast-iface"].as<std::string>();
+  }
+  if (result.count("srt"))
+    camera.srtUri = result["srt"].as<std::string>();
+  camera.srtLatency = result["srt-latency"].as<int>();
+  camera.srtStatsInterval = result["srt-stats-interval"].as<int>();
+  if (result.count("webrtc-port")) {
+#ifdef HAVE_WEBRTC
+    camera.webrtc.port = result["webrtc-port"].as<int>();
+    if (result.count("stun"))
+      camera.webrtc.stunServer = result["stun"].as<std::string>();
+#else
+    std::cout << "Built without WebRTC support" << std::endl;
+    return 1;
+#endif
+  }
+  if (result.count("rtsp-port")) {
+#ifdef HAVE_RTSP_SERVER
+    camera.rtspPort = result["rtsp-port"].as<int>();
+#else
+    std::cout << "Built without RTSP server support" << std::endl;
+    return 1;
+#endif
+  }
+  if (camera.thumbnailInterval <= 0) {
+    std::cout << "Thumbnail interval must be positive" << std::endl;
+    return 1;
+  }
+
   std::vector<std::string> clients;
   try {
     clients = result["address"].as<std::vector<std::string>>();
@@ -362,20 +2415,205 @@ int parseArgs(cxxopts::ParseResult result, CameraData &camera) {
     std::cout << e.what() << std::endl;
     return 1;
   }
+  camera.dnsTtl = result["dns-ttl"].as<int>();
+  camera.deadlineMs = result["deadline"].as<int>();
+  camera.nativePayloader = result.count("native-payloader") > 0;
+  camera.dedupe = result.count("dedupe") > 0;
+  camera.decodeConsumers = result["decode-consumers"].as<int>();
+  camera.previewScale = result["preview-scale"].as<int>();
+  camera.previewQuality = result["preview-quality"].as<int>();
+  camera.qualityTiers = result.count("quality-tiers") > 0;
+  if (camera.previewScale != 0 && camera.previewScale != 2 && camera.previewScale != 4 && camera.previewScale != 8) {
+    std::cout << "Preview scale must be 2, 4 or 8" << std::endl;
+    return 1;
+  }
+  if (camera.previewQuality < 1 || camera.previewQuality > 100) {
+    std::cout << "Preview quality must be between 1 and 100" << std::endl;
+    return 1;
+  }
+#ifndef HAVE_LIBJPEG
+  if (camera.decodeConsumers > 0 || camera.previewScale || camera.qualityTiers) {
+    std::cout << "Built without libjpeg support" << std::endl;
+    return 1;
+  }
+#endif
+  if (result.count("idle-park")) {
+    std::string idlePark = result["idle-park"].as<std::string>();
+    if (idlePark == "pause") {
+      camera.idlePark = IDLE_PARK_PAUSE;
+    } else if (idlePark == "ready") {
+      camera.idlePark = IDLE_PARK_READY;
+    } else {
+      std::cout << "Invalid idle park mode: " << idlePark << std::endl;
+      return 1;
+    }
+  }
+  if (result.count("shm-socket")) {
+#ifdef OS_LINUX
+    camera.shm.socketPath = result["shm-socket"].as<std::string>();
+    if (result["shm-slots"].as<int>() < 2) {
+      std::cout << "The shared memory ring needs at least 2 slots" << std::endl;
+      return 1;
+    }
+    camera.shm.slotCount = result["shm-slots"].as<int>();
+#else
+    std::cout << "Shared memory output is only supported on linux" << std::endl;
+    return 1;
+#endif
+  }
+  std::string corruptFrames = result["corrupt-frames"].as<std::string>();
+  if (corruptFrames == "drop") {
+    camera.corruptFrames = CORRUPT_DROP;
+  } else if (corruptFrames == "flag") {
+    camera.corruptFrames = CORRUPT_FLAG;
+  } else if (corruptFrames == "pass") {
+    camera.corruptFrames = CORRUPT_PASS;
+  } else {
+    std::cout << "Invalid corrupt frame handling: " << corruptFrames << std::endl;
+    return 1;
+  }
+  if (result.count("thread")) {
+#ifdef OS_LINUX
+    for (auto const &spec : result["thread"].as<std::vector<std::string>>()) {
+      std::string role;
+      ThreadProfile profile;
+      if (!parseThreadProfile(spec, role, profile)) {
+        std::cout << "Invalid thread profile: " << spec << std::endl;
+        return 1;
+      }
+      camera.threadProfiles[role] = profile;
+    }
+#else
+    std::cout << "Thread profiles are only supported on linux" << std::endl;
+    return 1;
+#endif
+  }
   for (auto const client : clients) {
-    std::regex clientRegex("([0-9]{1,3}(?:\\.[0-9]{1,3}){3}):([0-9]+)");
-    std::smatch clientMatch;
-    if (!std::regex_match(client, clientMatch, clientRegex)) {
+    std::string host;
+    int port;
+    if (!parseHostPort(client, host, port)) {
       std::cout << "Invalid client: " << client << std::endl;
       return 1;
     }
-    camera.addClient(Client(clientMatch[1], std::stoi(clientMatch[2])));
+    camera.addClient(Client(host, port));
+  }
+  if (result.count("preview-address")) {
+    if (!camera.previewScale) {
+      std::cout << "Preview clients need --preview-scale" << std::endl;
+      return 1;
+    }
+    for (auto const client : result["preview-address"].as<std::vector<std::string>>()) {
+      std::string host;
+      int port;
+      if (!parseHostPort(client, host, port)) {
+        std::cout << "Invalid preview client: " << client << std::endl;
+        return 1;
+      }
+      camera.addClient(Client(host, port), true);
+    }
   }
   return 0;
 }
 
+// Milliseconds since launch at which each startup phase finished, logged as one line once the first packet is sent
+struct StartupTimes {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  double gstInit = -1;
+  double caps = -1;
+  double init = -1;
+  double playing = -1;
+  double firstPacket = -1;
+  bool fastStart = false;
+  bool reported = false;
+
+  void mark(double &phase) { phase = elapsedMs(start); }
+  void report() {
+    if (reported || playing < 0 || firstPacket < 0)
+      return;
+    reported = true;
+    g_print("startup gst_init_ms=%.1f caps_ms=%.1f init_ms=%.1f playing_ms=%.1f first_packet_ms=%.1f fast_start=%d\n",
+            gstInit, caps, init, playing, firstPacket, fastStart);
+  }
+};
+
+// Plugins providing every element the base pipeline creates, in fast start mode only these and the plugins of the
+// enabled outputs are put in the registry. app is always needed, the export and roi commands use it at any time.
+const std::vector<std::string> FAST_START_PLUGINS = {"coreelements", "video4linux2", "rtp", "udp", "matroska", "app"};
+
+// Point GStreamer at a registry containing only the plugins we use, so gst_init neither scans the whole plugin
+// directory nor forks the plugin scanner. The registry is built on the first fast start and reused until a plugin
+// link changes or a plugin file is newer than it, as after an upgrade.
+bool setupFastStart(const std::string &dir, const std::vector<std::string> &plugins) {
+#if defined(OS_LINUX) && defined(GST_PLUGINS_DIR)
+  std::string pluginDir = dir + "/plugins";
+  if (g_mkdir_with_parents(pluginDir.c_str(), 0755) != 0) {
+    g_printerr("Could not create %s\n", pluginDir.c_str());
+    return false;
+  }
+  bool linksChanged = false;
+  time_t newestPlugin = 0;
+  for (auto const &plugin : plugins) {
+    // alternatives are separated by '|', for plugins that were renamed between GStreamer versions
+    std::string file, target;
+    std::istringstream alternatives(plugin);
+    for (std::string name; std::getline(alternatives, name, '|');) {
+      file = "libgst" + name + ".so";
+      target = std::string(GST_PLUGINS_DIR) + "/" + file;
+      if (g_file_test(target.c_str(), G_FILE_TEST_EXISTS))
+        break;
+    }
+    std::string link = pluginDir + "/" + file;
+    if (!g_file_test(target.c_str(), G_FILE_TEST_EXISTS)) {
+      g_printerr("Fast start disabled, plugin %s not found\n", target.c_str());
+      return false;
+    }
+    // a link made for another plugin directory, or for a plugin that was renamed since, is replaced
+    gchar *linked = g_file_read_link(link.c_str(), NULL);
+    bool current = linked && target == linked;
+    g_free(linked);
+    if (!current) {
+      unlink(link.c_str());
+      if (symlink(target.c_str(), link.c_str()) != 0) {
+        g_printerr("Could not link %s\n", link.c_str());
+        return false;
+      }
+      linksChanged = true;
+    }
+    // an upgrade that replaces the plugin in place only shows in its modification time
+    struct stat pluginStat;
+    if (stat(target.c_str(), &pluginStat) == 0)
+      newestPlugin = std::max(newestPlugin, pluginStat.st_mtime);
+  }
+  // a different plugin set or GStreamer version gets a different registry file
+  guint major, minor, micro, nano;
+  gst_version(&major, &minor, &micro, &nano);
+  std::string key = string_join(plugins, ",") + "@" + std::to_string(major) + "." + std::to_string(minor) + "." +
+                    std::to_string(micro) + "." + std::to_string(nano);
+  std::string registry = dir + "/registry-" + std::to_string(g_str_hash(key.c_str())) + ".bin";
+  struct stat registryStat;
+  bool registryExists = stat(registry.c_str(), &registryStat) == 0;
+  if (registryExists && (linksChanged || registryStat.st_mtime < newestPlugin)) {
+    // rebuilt from scratch by gst_init, a rescan of a registry that was still current would not rewrite it
+    unlink(registry.c_str());
+    registryExists = false;
+  }
+  g_setenv("GST_PLUGIN_SYSTEM_PATH_1_0", pluginDir.c_str(), TRUE);
+  g_unsetenv("GST_PLUGIN_PATH_1_0");
+  g_unsetenv("GST_PLUGIN_PATH");
+  g_setenv("GST_REGISTRY_1_0", registry.c_str(), TRUE);
+  g_setenv("GST_REGISTRY_FORK", "no", TRUE);
+  if (registryExists)
+    g_setenv("GST_REGISTRY_UPDATE", "no", TRUE);
+  return true;
+#else
+  g_printerr("Fast start is only supported on linux\n");
+  return false;
+#endif
+}
+
 GMainLoop *loop;
 CameraData camera;
+StartupTimes startup;
 static gboolean message_cb(GstBus *bus, GstMessage *message, gpointer user_data) {
   switch (GST_MESSAGE_TYPE(message)) {
   case GST_MESSAGE_ERROR: {
@@ -393,7 +2631,8 @@ static gboolean message_cb(GstBus *bus, GstMessage *message, gpointer user_data)
     g_free(debug);
     g_free(name);
 
-    g_main_loop_quit(loop);
+    if (!camera.recoverFrom(message))
+      g_main_loop_quit(loop);
     break;
   }
   case GST_MESSAGE_WARNING: {
@@ -419,6 +2658,10 @@ static gboolean message_cb(GstBus *bus, GstMessage *message, gpointer user_data)
       gst_message_parse_state_changed(message, &old_state, &new_state, &pending_state);
       g_print("Pipeline state changed from %s to %s:\n", gst_element_state_get_name(old_state),
               gst_element_state_get_name(new_state));
+      if (new_state == GST_STATE_PLAYING && startup.playing < 0) {
+        startup.mark(startup.playing);
+        startup.report();
+      }
     }
     break;
   }
@@ -433,6 +2676,27 @@ static gboolean message_cb(GstBus *bus, GstMessage *message, gpointer user_data)
   return TRUE;
 }
 
+static gboolean thumbnail_cb(gpointer user_data) {
+  if (!camera.snapshot(camera.thumbnailFile))
+    g_printerr("Could not write thumbnail %s\n", camera.thumbnailFile.c_str());
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean srt_stats_cb(gpointer user_data) {
+  camera.logSrtStats();
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean idle_park_cb(gpointer user_data) {
+  camera.updateDemand();
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean dns_refresh_cb(gpointer user_data) {
+  camera.refreshHosts();
+  return G_SOURCE_CONTINUE;
+}
+
 int main(int argc, char *argv[]) {
   cxxopts::Options options("cam2rtpfile",
                            "Takes a camera input and streams it over udp with rtp, and optionally records to a file");
@@ -441,8 +2705,63 @@ int main(int argc, char *argv[]) {
       ("f,framerate", "Framerate for the video source", cxxopts::value<int>())                           //
       ("r,resolution", "Resolution for the video source, i.e. 1920x1080", cxxopts::value<std::string>()) //
       ("a,address",
-       "List of udp addresses for stream, i.e. 10.0.0.1:1924,10.0.0.2:1925. Can be added and removed later.",
+       "List of udp addresses for stream, i.e. 10.0.0.1:1924,[fd00::2]:1925,ground.local:1926. Can be added and "
+       "removed later.",
+       cxxopts::value<std::vector<std::string>>()) //
+      ("native-payloader",
+       "Payload with the built in RTP/JPEG payloader instead of rtpjpegpay. Only it sends from the preallocated "
+       "packet pool, rtpjpegpay allocates every packet") //
+      ("corrupt-frames", "What to do with truncated or malformed camera frames: drop, flag or pass",
+       cxxopts::value<std::string>()->default_value("drop")) //
+      ("dedupe", "Skip frames identical to the previous one, sending one per second as a keepalive") //
+      ("shm-socket", "Share frames with local processes through a shared memory ring, handed out on this Unix socket",
+       cxxopts::value<std::string>()) //
+      ("shm-slots", "Frames kept in the shared memory ring", cxxopts::value<int>()->default_value("8")) //
+      ("recover", "Restart the capture with exponential backoff after errors instead of exiting, clients are kept and "
+                  "recordings continue in a new segment") //
+      ("idle-park", "Park the capture while there are no clients, recordings or other consumers: pause resumes "
+                    "within a frame, ready also stops the camera",
+       cxxopts::value<std::string>()) //
+      ("replay", "Play a recording instead of capturing from --camera, at its recorded pace. --resolution and "
+                 "--framerate are taken from its index and only needed without one",
+       cxxopts::value<std::string>()) //
+      ("replay-loop", "Restart the recording when it ends") //
+      ("replay-fast", "Play the recording as fast as the pipeline takes frames instead of at its recorded pace") //
+      ("preview-scale", "Also send a preview at 1/2, 1/4 or 1/8 of the resolution to its own clients, 0 disables it",
+       cxxopts::value<int>()->default_value("0")) //
+      ("preview-quality", "JPEG quality of the preview stream, 1-100", cxxopts::value<int>()->default_value("50")) //
+      ("preview-address", "List of udp addresses for the preview stream, like --address",
+       cxxopts::value<std::vector<std::string>>()) //
+      ("quality-tiers", "Let clients receive the stream requantized to a high, medium or low quality tier") //
+      ("decode-consumers", "Benchmark: number of synthetic consumers asking for every decoded frame",
+       cxxopts::value<int>()->default_value("0")) //
+      ("deadline", "Drop frames older than this many ms instead of sending them late, 0 disables",
+       cxxopts::value<int>()->default_value("0")) //
+      ("thread",
+       "Scheduling of a streaming thread as <role>:<cpu>[-<cpu>][:<fifo priority>], roles are capture, network, "
+       "record, srt, rtsp, preview and tier, i.e. --thread capture:2:60 --thread network:3:50 --thread record:0-1",
        cxxopts::value<std::vector<std::string>>()) //
+      ("dns-ttl", "Seconds before client hostnames are resolved again", cxxopts::value<int>()->default_value("60")) //
+      ("caps-cache", "Directory for cached camera caps, defaults to the user cache directory",
+       cxxopts::value<std::string>())                                     //
+      ("reprobe", "Probe the camera caps again instead of using the cache")                      //
+      ("fast-start", "Use a minimal plugin registry with only the elements the pipeline needs") //
+      ("thumbnail", "Periodically write the latest frame to this file", cxxopts::value<std::string>()) //
+      ("thumbnail-interval", "Seconds between thumbnails", cxxopts::value<int>()->default_value("5"))  //
+      ("multicast", "Also send the stream to this multicast group, i.e. 239.1.1.1:5004. Clients added with mcast "
+                    "are served by the group instead of unicast",
+       cxxopts::value<std::string>())                                                                   //
+      ("multicast-ttl", "TTL of multicast packets", cxxopts::value<int>()->default_value("1"))         //
+      ("multicast-iface", "Network interface to send multicast on", cxxopts::value<std::string>()) //
+      ("rtsp-port", "Serve the stream at rtsp://<host>:<port>/stream", cxxopts::value<int>())          //
+      ("srt", "Also send the stream over SRT, i.e. srt://10.0.0.1:7001?mode=caller or srt://:7001?mode=listener",
+       cxxopts::value<std::string>()) //
+      ("webrtc-port", "Serve a browser viewer over WebRTC at http://<host>:<port>/", cxxopts::value<int>()) //
+      ("stun", "STUN server for WebRTC peers outside the LAN, i.e. stun://stun.l.google.com:19302",
+       cxxopts::value<std::string>()) //
+      ("srt-latency", "SRT latency window in ms", cxxopts::value<int>()->default_value("125")) //
+      ("srt-stats-interval", "Seconds between SRT statistics log lines, 0 disables them",
+       cxxopts::value<int>()->default_value("5")) //
       ("h,help", "Print this help message");
   try {
     auto result = options.parse(argc, argv);
@@ -450,6 +2769,21 @@ int main(int argc, char *argv[]) {
       std::cout << std::endl << options.help() << std::endl;
       return 1;
     }
+    if (result.count("fast-start")) {
+      auto plugins = FAST_START_PLUGINS;
+      if (camera.rtspPort)
+        plugins.push_back("rtpmanager");
+      if (!camera.srtUri.empty())
+        plugins.push_back("srt");
+#ifdef HAVE_WEBRTC
+      if (camera.webrtc.port) {
+        for (auto plugin :
+             {"webrtc", "dtls", "srtp", "nice", "rtpmanager", "jpeg", "vpx", "videoconvertscale|videoconvert"})
+          plugins.push_back(plugin);
+      }
+#endif
+      startup.fastStart = setupFastStart(cacheDir(camera.capsCacheDir), plugins);
+    }
   } catch (cxxopts::exceptions::parsing e) {
     std::cout << e.what() << std::endl << std::endl << options.help() << std::endl;
     return 1;
@@ -457,6 +2791,20 @@ int main(int argc, char *argv[]) {
 
   /* Initialize GStreamer */
   gst_init(&argc, &argv);
+  if (camera.nativePayloader && !registerNativeJpegPay()) {
+    g_printerr("Could not register the native payloader\n");
+    return 1;
+  }
+  startup.mark(startup.gstInit);
+
+  /* Check the requested mode before the camera is opened by the pipeline */
+  if (camera.replay.path.empty() && camera.loadSupportedCaps() &&
+      !camera.supportsMode(camera.width, camera.height, camera.framerate)) {
+    g_printerr("Camera does not support %dx%d @ %d fps\n", camera.width, camera.height, camera.framerate);
+    camera.printSupportedModes();
+    return 1;
+  }
+  startup.mark(startup.caps);
 
   /* Create the empty pipeline */
   loop = g_main_loop_new(NULL, FALSE);
@@ -465,6 +2813,28 @@ int main(int argc, char *argv[]) {
   std::thread inputThread(inputLoop, &camera);
 
   camera.init();
+  startup.mark(startup.init);
+#ifdef HAVE_RTSP_SERVER
+  if (camera.rtspPort && !camera.startRtspServer())
+    return 1;
+#endif
+#ifdef HAVE_WEBRTC
+  if (camera.webrtc.port && !camera.webrtc.start())
+    return 1;
+#endif
+#ifdef OS_LINUX
+  if (!camera.shm.socketPath.empty()) {
+    // the slots can not grow once consumers mapped the ring
+    int ringWidth, ringHeight;
+    camera.largestMode(ringWidth, ringHeight);
+    if (!ringWidth || !ringHeight) {
+      g_printerr("The recording has no index, the frame ring needs --resolution to size its slots\n");
+      return 1;
+    }
+    if (!camera.shm.start(ringWidth, ringHeight))
+      return 1;
+  }
+#endif
 
   /* Add a bus watch, so we get notified when a message arrives */
   GstBus *bus = camera.getBus();
@@ -472,8 +2842,24 @@ int main(int argc, char *argv[]) {
   gst_object_unref(bus);
 
   /* Start playing */
+  watchFirstBuffer(
+      camera.udpsink, "sink", "", false,
+      [](double ms) {
+        startup.firstPacket = ms;
+        startup.report();
+      },
+      startup.start);
   camera.play();
 
+  if (!camera.thumbnailFile.empty())
+    g_timeout_add_seconds(camera.thumbnailInterval, thumbnail_cb, NULL);
+  if (!camera.srtUri.empty() && camera.srtStatsInterval > 0)
+    g_timeout_add_seconds(camera.srtStatsInterval, srt_stats_cb, NULL);
+  if (camera.dnsTtl > 0)
+    g_timeout_add_seconds(camera.dnsTtl, dns_refresh_cb, NULL);
+  if (camera.idlePark != IDLE_PARK_OFF)
+    g_timeout_add(100, idle_park_cb, NULL);
+
   /* Run event loop listening for bus messages until EOS or ERROR */
   g_print("Starting loop\n");
   g_main_loop_run(loop);
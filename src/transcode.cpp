@@ -0,0 +1,195 @@
+#include "transcode.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "jpegerror.hpp"
+
+bool encodeJpeg(const DecodedFrame &frame, int quality, std::vector<uint8_t> &jpeg) {
+  jpeg_compress_struct cinfo;
+  JpegError error;
+  // written by libjpeg through the pointer, so it is still valid after a longjmp
+  unsigned char *buffer = NULL;
+  unsigned long size = 0;
+  cinfo.err = jpeg_std_error(&error.mgr);
+  error.mgr.error_exit = jpeg_error_cb;
+  if (setjmp(error.jump)) {
+    jpeg_destroy_compress(&cinfo);
+    free(buffer);
+    return false;
+  }
+  jpeg_create_compress(&cinfo);
+  jpeg_mem_dest(&cinfo, &buffer, &size);
+  cinfo.image_width = frame.width;
+  cinfo.image_height = frame.height;
+  switch (frame.format) {
+  case DECODED_GRAY:
+    cinfo.input_components = 1;
+    cinfo.in_color_space = JCS_GRAYSCALE;
+    break;
+  case DECODED_RGB:
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    break;
+  case DECODED_YCBCR:
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_YCbCr;
+    break;
+  }
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality, TRUE);
+  cinfo.dct_method = JDCT_IFAST;
+  jpeg_start_compress(&cinfo, TRUE);
+  JSAMPROW rows[16];
+  while (cinfo.next_scanline < cinfo.image_height) {
+    JDIMENSION count = 0;
+    for (; count < 16 && cinfo.next_scanline + count < cinfo.image_height; count++)
+      rows[count] = const_cast<uint8_t *>(frame.pixels.data()) + (size_t)(cinfo.next_scanline + count) * frame.stride;
+    jpeg_write_scanlines(&cinfo, rows, count);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg.assign(buffer, buffer + size);
+  jpeg_destroy_compress(&cinfo);
+  free(buffer);
+  return true;
+}
+
+bool requantizeJpeg(const uint8_t *data, size_t size, int quality, std::vector<uint8_t> &jpeg) {
+  // zeroed so destroying a struct that was never created is a no-op
+  jpeg_decompress_struct src = {};
+  jpeg_compress_struct dst = {};
+  // one error manager for both, an error in either jumps back here
+  JpegError error;
+  unsigned char *buffer = NULL;
+  unsigned long outputSize = 0;
+  src.err = dst.err = jpeg_std_error(&error.mgr);
+  error.mgr.error_exit = jpeg_error_cb;
+  error.mgr.output_message = jpeg_message_cb;
+  if (setjmp(error.jump)) {
+    jpeg_destroy_compress(&dst);
+    jpeg_destroy_decompress(&src);
+    free(buffer);
+    return false;
+  }
+  jpeg_create_decompress(&src);
+  jpeg_create_compress(&dst);
+  jpeg_mem_src(&src, const_cast<unsigned char *>(data), size);
+  jpeg_read_header(&src, TRUE);
+  jvirt_barray_ptr *coefficients = jpeg_read_coefficients(&src);
+  jpeg_copy_critical_parameters(&src, &dst);
+  // replaces tables 0 and 1, which cameras use for luma and chroma
+  jpeg_set_quality(&dst, quality, TRUE);
+  for (int i = 0; i < NUM_QUANT_TBLS; i++) {
+    JQUANT_TBL *table = dst.quant_tbl_ptrs[i];
+    if (!table || !src.quant_tbl_ptrs[i])
+      continue;
+    for (int k = 0; k < DCTSIZE2; k++)
+      table->quantval[k] = std::max(table->quantval[k], src.quant_tbl_ptrs[i]->quantval[k]);
+  }
+  for (int ci = 0; ci < src.num_components; ci++) {
+    jpeg_component_info *component = &src.comp_info[ci];
+    const UINT16 *from = component->quant_table->quantval;
+    const UINT16 *to = dst.quant_tbl_ptrs[component->quant_tbl_no]->quantval;
+    if (std::equal(from, from + DCTSIZE2, to))
+      continue;
+    // the coefficient arrays are padded to whole MCUs, the padding is coded too
+    JDIMENSION width = (component->width_in_blocks + component->h_samp_factor - 1) / component->h_samp_factor *
+                       component->h_samp_factor;
+    JDIMENSION height = (component->height_in_blocks + component->v_samp_factor - 1) / component->v_samp_factor *
+                        component->v_samp_factor;
+    for (JDIMENSION row = 0; row < height; row++) {
+      JBLOCKARRAY blocks = (*src.mem->access_virt_barray)((j_common_ptr)&src, coefficients[ci], row, 1, TRUE);
+      for (JDIMENSION col = 0; col < width; col++) {
+        JCOEF *block = blocks[0][col];
+        for (int k = 0; k < DCTSIZE2; k++) {
+          if (!block[k])
+            continue;
+          // rounded to the nearest step of the new table
+          int value = block[k] * from[k];
+          block[k] = (JCOEF)(value >= 0 ? (value + to[k] / 2) / to[k] : -((-value + to[k] / 2) / to[k]));
+        }
+      }
+    }
+  }
+  jpeg_mem_dest(&dst, &buffer, &outputSize);
+  jpeg_write_coefficients(&dst, coefficients);
+  jpeg_finish_compress(&dst);
+  jpeg_finish_decompress(&src);
+  jpeg.assign(buffer, buffer + outputSize);
+  jpeg_destroy_compress(&dst);
+  jpeg_destroy_decompress(&src);
+  free(buffer);
+  return true;
+}
+
+bool cropJpeg(const uint8_t *data, size_t size, int &x, int &y, int &width, int &height, std::vector<uint8_t> &jpeg) {
+  jpeg_decompress_struct src = {};
+  jpeg_compress_struct dst = {};
+  JpegError error;
+  unsigned char *buffer = NULL;
+  unsigned long outputSize = 0;
+  src.err = dst.err = jpeg_std_error(&error.mgr);
+  error.mgr.error_exit = jpeg_error_cb;
+  error.mgr.output_message = jpeg_message_cb;
+  if (setjmp(error.jump)) {
+    jpeg_destroy_compress(&dst);
+    jpeg_destroy_decompress(&src);
+    free(buffer);
+    return false;
+  }
+  jpeg_create_decompress(&src);
+  jpeg_create_compress(&dst);
+  jpeg_mem_src(&src, const_cast<unsigned char *>(data), size);
+  jpeg_read_header(&src, TRUE);
+  int mcuWidth = src.max_h_samp_factor * DCTSIZE;
+  int mcuHeight = src.max_v_samp_factor * DCTSIZE;
+  int frameWidth = src.image_width;
+  int frameHeight = src.image_height;
+  if (x < 0 || y < 0 || width <= 0 || height <= 0 || x >= frameWidth || y >= frameHeight) {
+    jpeg_destroy_compress(&dst);
+    jpeg_destroy_decompress(&src);
+    return false;
+  }
+  int right = std::min(frameWidth, (x + width + mcuWidth - 1) / mcuWidth * mcuWidth);
+  int bottom = std::min(frameHeight, (y + height + mcuHeight - 1) / mcuHeight * mcuHeight);
+  x = x / mcuWidth * mcuWidth;
+  y = y / mcuHeight * mcuHeight;
+  width = right - x;
+  height = bottom - y;
+  int mcuColumns = (width + mcuWidth - 1) / mcuWidth;
+  int mcuRows = (height + mcuHeight - 1) / mcuHeight;
+  // the cropped arrays have to be requested before jpeg_read_coefficients realizes the arrays of the frame
+  auto cropped = (jvirt_barray_ptr *)(*src.mem->alloc_small)((j_common_ptr)&src, JPOOL_IMAGE,
+                                                              sizeof(jvirt_barray_ptr) * src.num_components);
+  for (int ci = 0; ci < src.num_components; ci++) {
+    jpeg_component_info *component = &src.comp_info[ci];
+    cropped[ci] = (*src.mem->request_virt_barray)((j_common_ptr)&src, JPOOL_IMAGE, FALSE,
+                                                  mcuColumns * component->h_samp_factor,
+                                                  mcuRows * component->v_samp_factor, component->v_samp_factor);
+  }
+  jvirt_barray_ptr *coefficients = jpeg_read_coefficients(&src);
+  jpeg_copy_critical_parameters(&src, &dst);
+  dst.image_width = width;
+  dst.image_height = height;
+  for (int ci = 0; ci < src.num_components; ci++) {
+    jpeg_component_info *component = &src.comp_info[ci];
+    JDIMENSION columns = mcuColumns * component->h_samp_factor;
+    JDIMENSION rows = mcuRows * component->v_samp_factor;
+    JDIMENSION left = x / mcuWidth * component->h_samp_factor;
+    JDIMENSION top = y / mcuHeight * component->v_samp_factor;
+    for (JDIMENSION row = 0; row < rows; row++) {
+      JBLOCKARRAY from = (*src.mem->access_virt_barray)((j_common_ptr)&src, coefficients[ci], top + row, 1, FALSE);
+      JBLOCKARRAY to = (*src.mem->access_virt_barray)((j_common_ptr)&src, cropped[ci], row, 1, TRUE);
+      memcpy(to[0], from[0] + left, columns * sizeof(JBLOCK));
+    }
+  }
+  jpeg_mem_dest(&dst, &buffer, &outputSize);
+  jpeg_write_coefficients(&dst, cropped);
+  jpeg_finish_compress(&dst);
+  jpeg_finish_decompress(&src);
+  jpeg.assign(buffer, buffer + outputSize);
+  jpeg_destroy_compress(&dst);
+  jpeg_destroy_decompress(&src);
+  free(buffer);
+  return true;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "framecache.hpp"
+
+// Encodes decoded pixels as a baseline JPEG with 4:2:0 chroma at the given libjpeg quality (1-100)
+bool encodeJpeg(const DecodedFrame &frame, int quality, std::vector<uint8_t> &jpeg);
+
+// Lowers the quality of a JPEG without decoding it. The DCT coefficients are entropy decoded, rescaled from the
+// frame's quantization tables to the standard tables at the given quality and entropy coded again with the standard
+// Huffman tables, so there is no IDCT, DCT or color conversion. Tables of the frame that are already coarser than the
+// target are kept, quality never goes up.
+bool requantizeJpeg(const uint8_t *data, size_t size, int quality, std::vector<uint8_t> &jpeg);
+
+// Cuts a region out of a JPEG without decoding it. The region is widened to whole MCUs, 16 pixels for the usual
+// 4:2:0 and 4:2:2 camera frames, and clipped to the frame, the MCUs inside are copied as they are so the crop is
+// lossless. The region actually cropped is returned in x, y, width and height.
+bool cropJpeg(const uint8_t *data, size_t size, int &x, int &y, int &width, int &height, std::vector<uint8_t> &jpeg);
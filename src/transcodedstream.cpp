@@ -0,0 +1,132 @@
+#include "transcodedstream.hpp"
+#include <chrono>
+#include <ctime>
+
+// cpu time of the calling thread in ns, wall time where that is not available
+static guint64 threadCpuNs() {
+#ifdef __linux__
+  timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return (guint64)now.tv_sec * 1000000000 + now.tv_nsec;
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+int TranscodedStream::init(GstElement *pipeline, GstElement *videoTee, const char *payloader) {
+  this->pipeline = pipeline;
+  this->videoTee = videoTee;
+  queue = gst_element_factory_make("queue", (name + "Queue").c_str());
+  sink = gst_element_factory_make("appsink", (name + "Sink").c_str());
+  src = gst_element_factory_make("appsrc", (name + "Src").c_str());
+  pay = gst_element_factory_make(payloader, (name + "Pay").c_str());
+  udpSink = gst_element_factory_make("multiudpsink", (name + "UdpSink").c_str());
+  if (!queue || !sink || !src || !pay || !udpSink) {
+    g_printerr("Could not create the %s elements\n", name.c_str());
+    return -1;
+  }
+  gst_bin_add_many(GST_BIN(pipeline), queue, sink, src, pay, udpSink, NULL);
+  if (!gst_element_link_many(videoTee, queue, sink, NULL) || !gst_element_link_many(src, pay, udpSink, NULL)) {
+    g_printerr("Failed to link %s\n", name.c_str());
+    return -1;
+  }
+  g_object_set(G_OBJECT(queue), "leaky", 2, "max-size-buffers", 1, NULL);
+  g_object_set(G_OBJECT(sink), "sync", false, "async", false, "max-buffers", 1, "drop", true, NULL);
+  g_object_set(G_OBJECT(src), "is-live", true, "format", GST_FORMAT_TIME, NULL);
+  g_object_set(G_OBJECT(udpSink), "auto-multicast", true, "sync", false, "async", false, NULL);
+  GstAppSinkCallbacks callbacks = {};
+  callbacks.new_sample = sample_cb;
+  gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks, this, NULL);
+  GstPad *queuePad = gst_element_get_static_pad(queue, "sink");
+  teePad = gst_pad_get_peer(queuePad);
+  gst_object_unref(queuePad);
+  // no-ops while the pipeline is being built, starts the stream when added to a running pipeline
+  for (GstElement *element : {udpSink, pay, src, sink, queue})
+    gst_element_sync_state_with_parent(element);
+  return 0;
+}
+
+void TranscodedStream::remove(std::function<void()> removed) {
+  active = false;
+  this->removed = removed;
+  gst_pad_add_probe(teePad, GST_PAD_PROBE_TYPE_IDLE, unlink_cb, this, NULL);
+}
+
+GstPadProbeReturn TranscodedStream::unlink_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  auto self = static_cast<TranscodedStream *>(user_data);
+  GstPad *queuePad = gst_element_get_static_pad(self->queue, "sink");
+  gst_pad_unlink(self->teePad, queuePad);
+  gst_object_unref(queuePad);
+  g_idle_add(remove_cb, self);
+  return GST_PAD_PROBE_REMOVE;
+}
+
+gboolean TranscodedStream::remove_cb(gpointer user_data) {
+  auto self = static_cast<TranscodedStream *>(user_data);
+  gst_element_release_request_pad(self->videoTee, self->teePad);
+  gst_object_unref(self->teePad);
+  self->teePad = NULL;
+  // the queue first, stopping its thread guarantees no transcode is still running
+  for (GstElement *element : {self->queue, self->sink, self->src, self->pay, self->udpSink})
+    gst_element_set_state(element, GST_STATE_NULL);
+  gst_bin_remove_many(GST_BIN(self->pipeline), self->queue, self->sink, self->src, self->pay, self->udpSink, NULL);
+  self->udpSink = NULL;
+  // moved out first, the callback may delete the stream and with it this function
+  auto removed = std::move(self->removed);
+  if (removed)
+    removed();
+  return G_SOURCE_REMOVE;
+}
+
+GstFlowReturn TranscodedStream::sample_cb(GstAppSink *appsink, gpointer user_data) {
+  auto self = static_cast<TranscodedStream *>(user_data);
+  GstSample *sample = gst_app_sink_pull_sample(appsink);
+  if (!sample)
+    return GST_FLOW_OK;
+  if (!self->active) {
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+  }
+  if (gst_app_src_get_current_level_bytes(GST_APP_SRC(self->src)) > 0) {
+    self->skipped++;
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+  }
+  GstBuffer *buffer = gst_sample_get_buffer(sample);
+  guint64 start = threadCpuNs();
+  bool transcoded = self->transcode(buffer, self->output);
+  self->cpuNs += threadCpuNs() - start;
+  if (!transcoded) {
+    self->failed++;
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+  }
+  GstCaps *caps = gst_caps_copy(gst_sample_get_caps(sample));
+  int width, height;
+  GstStructure *structure = gst_caps_get_structure(caps, 0);
+  if (self->width > 0 && self->height > 0) {
+    gst_caps_set_simple(caps, "width", G_TYPE_INT, self->width, "height", G_TYPE_INT, self->height, NULL);
+  } else if (self->scale > 1 && gst_structure_get_int(structure, "width", &width) &&
+             gst_structure_get_int(structure, "height", &height)) {
+    // libjpeg rounds scaled sizes up
+    gst_caps_set_simple(caps, "width", G_TYPE_INT, (width + self->scale - 1) / self->scale, "height", G_TYPE_INT,
+                        (height + self->scale - 1) / self->scale, NULL);
+  }
+  GstCaps *current = gst_app_src_get_caps(GST_APP_SRC(self->src));
+  if (!current || !gst_caps_is_equal(current, caps))
+    gst_app_src_set_caps(GST_APP_SRC(self->src), caps);
+  if (current)
+    gst_caps_unref(current);
+  gst_caps_unref(caps);
+  GstBuffer *frame = gst_buffer_new_allocate(NULL, self->output.size(), NULL);
+  gst_buffer_fill(frame, 0, self->output.data(), self->output.size());
+  GST_BUFFER_PTS(frame) = GST_BUFFER_PTS(buffer);
+  GST_BUFFER_DURATION(frame) = GST_BUFFER_DURATION(buffer);
+  gst_app_src_push_buffer(GST_APP_SRC(self->src), frame);
+  self->frames++;
+  self->bytesIn += gst_buffer_get_size(buffer);
+  self->bytesOut += self->output.size();
+  gst_sample_unref(sample);
+  return GST_FLOW_OK;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <gst/app/app.h>
+#include <gst/gst.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A network output carrying a transcoded copy of the camera frames, such as the preview or a quality tier. Frames
+// leave the tee through a one-frame leaky queue into an appsink and are transcoded on that queue's thread, then an
+// appsrc feeds them to a payloader and multiudpsink of their own. A slow transcode only drops frames of this output,
+// and while the previous frame has not been payloaded the next one is skipped before any work is spent on it. Streams
+// can be added to and removed from a running pipeline.
+class TranscodedStream {
+public:
+  // prefix of the element names, the queue is <name>Queue
+  std::string name;
+  // the output is 1/scale of the camera resolution
+  int scale = 1;
+  // turns a camera frame into the frame sent, false drops it
+  std::function<bool(GstBuffer *frame, std::vector<uint8_t> &jpeg)> transcode;
+  // size of the frames sent when it is not the camera's size divided by scale, such as a crop. Set by transcode, only
+  // touched on the queue's thread.
+  int width = 0;
+  int height = 0;
+  // frames are only transcoded while someone receives them
+  std::atomic<bool> active{false};
+  GstElement *udpSink = NULL;
+  // addresses currently configured on the udpsink
+  std::vector<std::pair<std::string, int>> destinations;
+  // Frames sent, skipped because the previous one was still queued, failed to transcode, their size before and
+  // after, and the cpu time spent transcoding
+  std::atomic<guint64> frames{0};
+  std::atomic<guint64> skipped{0};
+  std::atomic<guint64> failed{0};
+  std::atomic<guint64> bytesIn{0};
+  std::atomic<guint64> bytesOut{0};
+  std::atomic<guint64> cpuNs{0};
+
+  int init(GstElement *pipeline, GstElement *videoTee, const char *payloader);
+  // unlinks from the tee once no frame is in flight there, the elements are removed on the main loop and then
+  // removed is called, which may delete the stream
+  void remove(std::function<void()> removed);
+
+private:
+  GstElement *pipeline = NULL;
+  GstElement *videoTee = NULL;
+  GstPad *teePad = NULL;
+  std::function<void()> removed;
+  GstElement *queue = NULL;
+  GstElement *sink = NULL;
+  GstElement *src = NULL;
+  GstElement *pay = NULL;
+  // reused for every frame, only touched on the queue's thread
+  std::vector<uint8_t> output;
+
+  static GstFlowReturn sample_cb(GstAppSink *appsink, gpointer user_data);
+  static GstPadProbeReturn unlink_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+  static gboolean remove_cb(gpointer user_data);
+};
@@ -0,0 +1,347 @@
+#define GST_USE_UNSTABLE_API
+#include "webrtc.hpp"
+#include <algorithm>
+#include <cstring>
+#include <gst/webrtc/webrtc.h>
+#include <json-glib/json-glib.h>
+
+static const char *VIEWER_PAGE = R"(<!DOCTYPE html>
+<html>
+<head><title>cam2rtpfile</title></head>
+<body style="margin:0;background:#000">
+<video id="video" autoplay muted playsinline style="width:100vw;height:100vh"></video>
+<script>
+const pc = new RTCPeerConnection();
+const ws = new WebSocket("ws://" + location.host + "/ws");
+pc.ontrack = (e) => { document.getElementById("video").srcObject = e.streams[0]; };
+pc.onicecandidate = (e) => {
+  if (e.candidate)
+    ws.send(JSON.stringify({type: "ice", candidate: e.candidate.candidate, sdpMLineIndex: e.candidate.sdpMLineIndex}));
+};
+ws.onmessage = async (e) => {
+  const msg = JSON.parse(e.data);
+  if (msg.type === "offer") {
+    await pc.setRemoteDescription({type: "offer", sdp: msg.sdp});
+    const answer = await pc.createAnswer();
+    await pc.setLocalDescription(answer);
+    ws.send(JSON.stringify({type: "answer", sdp: answer.sdp}));
+  } else if (msg.type === "ice") {
+    await pc.addIceCandidate({candidate: msg.candidate, sdpMLineIndex: msg.sdpMLineIndex});
+  }
+};
+</script>
+</body>
+</html>
+)";
+
+// A signalling message queued for the main context, websocket connections are not thread safe
+struct PendingMessage {
+  SoupWebsocketConnection *connection;
+  gchar *text;
+};
+
+// Offer creation completes on a webrtcbin thread
+struct OfferContext {
+  WebRtcServer *server;
+  GstElement *webrtc;
+};
+
+static void offer_context_free(gpointer user_data) {
+  auto context = static_cast<OfferContext *>(user_data);
+  gst_object_unref(context->webrtc);
+  delete context;
+}
+
+WebRtcServer::~WebRtcServer() {
+  if (server)
+    g_object_unref(server);
+  for (auto peer : peers) {
+    g_object_unref(peer->connection);
+    gst_object_unref(peer->teePad);
+    delete peer;
+  }
+}
+
+int WebRtcServer::init(GstElement *pipeline, GstElement *videoTee) {
+  this->pipeline = pipeline;
+  queue = gst_element_factory_make("queue", "webrtcQueue");
+  valve = gst_element_factory_make("valve", "webrtcValve");
+  decoder = gst_element_factory_make("jpegdec", "webrtcDec");
+  convert = gst_element_factory_make("videoconvert", "webrtcConvert");
+  encoder = gst_element_factory_make("vp8enc", "webrtcEnc");
+  pay = gst_element_factory_make("rtpvp8pay", "webrtcPay");
+  rtpTee = gst_element_factory_make("tee", "webrtcTee");
+  if (!queue || !valve || !decoder || !convert || !encoder || !pay || !rtpTee) {
+    g_printerr("Could not create webrtc encoder elements");
+    return -1;
+  }
+  gst_bin_add_many(GST_BIN(pipeline), queue, valve, decoder, convert, encoder, pay, rtpTee, NULL);
+  if (!gst_element_link_many(videoTee, queue, valve, decoder, convert, encoder, pay, rtpTee, NULL)) {
+    g_printerr("Failed to link webrtc");
+    return -1;
+  }
+  g_object_set(G_OBJECT(queue), "leaky", 2, "max-size-buffers", 1, NULL);
+  // nothing is decoded or encoded until the first peer connects
+  g_object_set(G_OBJECT(valve), "drop", true, NULL);
+  g_object_set(G_OBJECT(encoder), "deadline", (gint64)1, "cpu-used", 8, "end-usage", 1, "target-bitrate", 2000000,
+               "keyframe-max-dist", 60, NULL);
+  g_object_set(G_OBJECT(pay), "pt", 96, NULL);
+  g_object_set(G_OBJECT(rtpTee), "allow-not-linked", true, NULL);
+  return 0;
+}
+
+bool WebRtcServer::start() {
+  server = soup_server_new(SOUP_SERVER_SERVER_HEADER, "cam2rtpfile", NULL);
+  soup_server_add_handler(server, "/", http_cb, this, NULL);
+  soup_server_add_websocket_handler(server, "/ws", NULL, NULL, websocket_cb, this, NULL);
+  GError *error = NULL;
+  if (!soup_server_listen_all(server, port, (SoupServerListenOptions)0, &error)) {
+    g_printerr("Could not start WebRTC signalling server: %s\n", error->message);
+    g_error_free(error);
+    return false;
+  }
+  g_print("WebRTC viewer at http://0.0.0.0:%d/\n", port);
+  return true;
+}
+
+size_t WebRtcServer::peerCount() {
+  std::lock_guard<std::mutex> lock(peersMutex);
+  return peers.size();
+}
+
+void WebRtcServer::addPeer(SoupWebsocketConnection *connection) {
+  auto peer = new Peer{this, connection, NULL, NULL, NULL};
+  peer->queue = gst_element_factory_make("queue", NULL);
+  peer->webrtc = gst_element_factory_make("webrtcbin", NULL);
+  if (!peer->queue || !peer->webrtc) {
+    g_printerr("Could not create 'webrtcbin' element\n");
+    if (peer->queue)
+      gst_object_unref(peer->queue);
+    if (peer->webrtc)
+      gst_object_unref(peer->webrtc);
+    delete peer;
+    soup_websocket_connection_close(connection, SOUP_WEBSOCKET_CLOSE_SERVER_ERROR, NULL);
+    return;
+  }
+  g_object_ref(connection);
+  // a slow peer loses packets instead of holding back the others
+  g_object_set(G_OBJECT(peer->queue), "leaky", 2, "max-size-buffers", 50, NULL);
+  g_object_set(G_OBJECT(peer->webrtc), "bundle-policy", GST_WEBRTC_BUNDLE_POLICY_MAX_BUNDLE, NULL);
+  if (!stunServer.empty())
+    g_object_set(G_OBJECT(peer->webrtc), "stun-server", stunServer.c_str(), NULL);
+  g_signal_connect(peer->webrtc, "on-negotiation-needed", G_CALLBACK(negotiation_needed_cb), this);
+  g_signal_connect(peer->webrtc, "on-ice-candidate", G_CALLBACK(ice_candidate_cb), this);
+
+  gst_bin_add_many(GST_BIN(pipeline), peer->queue, peer->webrtc, NULL);
+  peer->teePad = gst_element_get_request_pad(rtpTee, "src_%u");
+  GstPad *queuePad = gst_element_get_static_pad(peer->queue, "sink");
+  gst_pad_link(peer->teePad, queuePad);
+  gst_object_unref(queuePad);
+  gst_element_link(peer->queue, peer->webrtc);
+
+  GstWebRTCRTPTransceiver *transceiver = NULL;
+  g_signal_emit_by_name(peer->webrtc, "get-transceiver", 0, &transceiver);
+  if (transceiver) {
+    g_object_set(G_OBJECT(transceiver), "direction", GST_WEBRTC_RTP_TRANSCEIVER_DIRECTION_SENDONLY, NULL);
+    gst_object_unref(transceiver);
+  }
+
+  size_t count;
+  {
+    std::lock_guard<std::mutex> lock(peersMutex);
+    peers.push_back(peer);
+    count = peers.size();
+  }
+  gst_element_sync_state_with_parent(peer->queue);
+  gst_element_sync_state_with_parent(peer->webrtc);
+  g_object_set(G_OBJECT(valve), "drop", false, NULL);
+
+  // the new peer can only start decoding at a keyframe
+  GstPad *encoderPad = gst_element_get_static_pad(encoder, "src");
+  GstStructure *forceKeyUnit = gst_structure_new("GstForceKeyUnit", "all-headers", G_TYPE_BOOLEAN, TRUE, NULL);
+  gst_pad_send_event(encoderPad, gst_event_new_custom(GST_EVENT_CUSTOM_UPSTREAM, forceKeyUnit));
+  gst_object_unref(encoderPad);
+  g_print("WebRTC peer connected, %zu peers\n", count);
+}
+
+void WebRtcServer::removePeer(SoupWebsocketConnection *connection) {
+  Peer *peer = NULL;
+  size_t count;
+  {
+    std::lock_guard<std::mutex> lock(peersMutex);
+    auto it = std::find_if(peers.begin(), peers.end(), [connection](Peer *p) { return p->connection == connection; });
+    if (it != peers.end()) {
+      peer = *it;
+      peers.erase(it);
+    }
+    count = peers.size();
+  }
+  if (!peer)
+    return;
+  if (count == 0)
+    g_object_set(G_OBJECT(valve), "drop", true, NULL);
+  // unlink once no buffer is in flight on the tee pad, the elements are removed on the main loop afterwards
+  gst_pad_add_probe(peer->teePad, GST_PAD_PROBE_TYPE_IDLE, unlink_peer_cb, peer, NULL);
+  g_print("WebRTC peer disconnected, %zu peers\n", count);
+}
+
+SoupWebsocketConnection *WebRtcServer::connectionFor(GstElement *webrtc) {
+  std::lock_guard<std::mutex> lock(peersMutex);
+  for (auto peer : peers)
+    if (peer->webrtc == webrtc)
+      return SOUP_WEBSOCKET_CONNECTION(g_object_ref(peer->connection));
+  return NULL;
+}
+
+void WebRtcServer::send(GstElement *webrtc, const gchar *type, const gchar *key, const gchar *value,
+                        gint mlineIndex) {
+  SoupWebsocketConnection *connection = connectionFor(webrtc);
+  if (!connection)
+    return;
+  JsonBuilder *builder = json_builder_new();
+  json_builder_begin_object(builder);
+  json_builder_set_member_name(builder, "type");
+  json_builder_add_string_value(builder, type);
+  json_builder_set_member_name(builder, key);
+  json_builder_add_string_value(builder, value);
+  if (mlineIndex >= 0) {
+    json_builder_set_member_name(builder, "sdpMLineIndex");
+    json_builder_add_int_value(builder, mlineIndex);
+  }
+  json_builder_end_object(builder);
+  JsonNode *root = json_builder_get_root(builder);
+  g_idle_add(send_cb, new PendingMessage{connection, json_to_string(root, FALSE)});
+  json_node_unref(root);
+  g_object_unref(builder);
+}
+
+void WebRtcServer::handleMessage(SoupWebsocketConnection *connection, const gchar *text) {
+  GstElement *webrtc = NULL;
+  {
+    std::lock_guard<std::mutex> lock(peersMutex);
+    for (auto peer : peers)
+      if (peer->connection == connection)
+        webrtc = GST_ELEMENT(gst_object_ref(peer->webrtc));
+  }
+  if (!webrtc)
+    return;
+  JsonParser *parser = json_parser_new();
+  JsonNode *root = json_parser_load_from_data(parser, text, -1, NULL) ? json_parser_get_root(parser) : NULL;
+  JsonObject *object = root && JSON_NODE_HOLDS_OBJECT(root) ? json_node_get_object(root) : NULL;
+  const gchar *type = object && json_object_has_member(object, "type")
+                          ? json_object_get_string_member(object, "type")
+                          : NULL;
+  if (type && !strcmp(type, "answer") && json_object_has_member(object, "sdp")) {
+    const gchar *text = json_object_get_string_member(object, "sdp");
+    GstSDPMessage *sdp = NULL;
+    gst_sdp_message_new(&sdp);
+    if (gst_sdp_message_parse_buffer((const guint8 *)text, strlen(text), sdp) == GST_SDP_OK) {
+      GstWebRTCSessionDescription *answer = gst_webrtc_session_description_new(GST_WEBRTC_SDP_TYPE_ANSWER, sdp);
+      g_signal_emit_by_name(webrtc, "set-remote-description", answer, NULL);
+      gst_webrtc_session_description_free(answer);
+    } else {
+      gst_sdp_message_free(sdp);
+      g_printerr("Invalid SDP answer from WebRTC peer\n");
+    }
+  } else if (type && !strcmp(type, "ice") && json_object_has_member(object, "candidate") &&
+             json_object_has_member(object, "sdpMLineIndex")) {
+    guint mlineIndex = (guint)json_object_get_int_member(object, "sdpMLineIndex");
+    const gchar *candidate = json_object_get_string_member(object, "candidate");
+    g_signal_emit_by_name(webrtc, "add-ice-candidate", mlineIndex, candidate);
+  } else {
+    g_printerr("Unknown WebRTC signalling message: %s\n", text);
+  }
+  g_object_unref(parser);
+  gst_object_unref(webrtc);
+}
+
+void WebRtcServer::http_cb(SoupServer *server, SoupMessage *msg, const char *path, GHashTable *query,
+                           SoupClientContext *client, gpointer user_data) {
+  if (strcmp(path, "/") != 0) {
+    soup_message_set_status(msg, SOUP_STATUS_NOT_FOUND);
+    return;
+  }
+  soup_message_set_response(msg, "text/html", SOUP_MEMORY_STATIC, VIEWER_PAGE, strlen(VIEWER_PAGE));
+  soup_message_set_status(msg, SOUP_STATUS_OK);
+}
+
+void WebRtcServer::websocket_cb(SoupServer *server, SoupWebsocketConnection *connection, const char *path,
+                                SoupClientContext *client, gpointer user_data) {
+  auto self = static_cast<WebRtcServer *>(user_data);
+  g_signal_connect(connection, "message", G_CALLBACK(message_cb), self);
+  g_signal_connect(connection, "closed", G_CALLBACK(closed_cb), self);
+  self->addPeer(connection);
+}
+
+void WebRtcServer::message_cb(SoupWebsocketConnection *connection, gint type, GBytes *message, gpointer user_data) {
+  if (type != SOUP_WEBSOCKET_DATA_TEXT)
+    return;
+  gsize size;
+  const gchar *data = (const gchar *)g_bytes_get_data(message, &size);
+  std::string text(data, size);
+  static_cast<WebRtcServer *>(user_data)->handleMessage(connection, text.c_str());
+}
+
+void WebRtcServer::closed_cb(SoupWebsocketConnection *connection, gpointer user_data) {
+  static_cast<WebRtcServer *>(user_data)->removePeer(connection);
+}
+
+void WebRtcServer::negotiation_needed_cb(GstElement *webrtc, gpointer user_data) {
+  auto context = new OfferContext{static_cast<WebRtcServer *>(user_data), GST_ELEMENT(gst_object_ref(webrtc))};
+  GstPromise *promise = gst_promise_new_with_change_func(offer_created_cb, context, offer_context_free);
+  g_signal_emit_by_name(webrtc, "create-offer", NULL, promise);
+}
+
+void WebRtcServer::offer_created_cb(GstPromise *promise, gpointer user_data) {
+  auto context = static_cast<OfferContext *>(user_data);
+  GstWebRTCSessionDescription *offer = NULL;
+  const GstStructure *reply = gst_promise_get_reply(promise);
+  if (reply)
+    gst_structure_get(reply, "offer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &offer, NULL);
+  gst_promise_unref(promise);
+  if (!offer) {
+    g_printerr("Could not create WebRTC offer\n");
+    return;
+  }
+  g_signal_emit_by_name(context->webrtc, "set-local-description", offer, NULL);
+  gchar *sdp = gst_sdp_message_as_text(offer->sdp);
+  context->server->send(context->webrtc, "offer", "sdp", sdp);
+  g_free(sdp);
+  gst_webrtc_session_description_free(offer);
+}
+
+void WebRtcServer::ice_candidate_cb(GstElement *webrtc, guint mlineIndex, gchar *candidate, gpointer user_data) {
+  static_cast<WebRtcServer *>(user_data)->send(webrtc, "ice", "candidate", candidate, mlineIndex);
+}
+
+GstPadProbeReturn WebRtcServer::unlink_peer_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  auto peer = static_cast<Peer *>(user_data);
+  GstPad *queuePad = gst_element_get_static_pad(peer->queue, "sink");
+  gst_pad_unlink(peer->teePad, queuePad);
+  gst_object_unref(queuePad);
+  g_idle_add(remove_peer_cb, peer);
+  return GST_PAD_PROBE_REMOVE;
+}
+
+gboolean WebRtcServer::remove_peer_cb(gpointer user_data) {
+  auto peer = static_cast<Peer *>(user_data);
+  auto self = peer->server;
+  gst_element_release_request_pad(self->rtpTee, peer->teePad);
+  gst_object_unref(peer->teePad);
+  gst_element_set_state(peer->webrtc, GST_STATE_NULL);
+  gst_element_set_state(peer->queue, GST_STATE_NULL);
+  gst_bin_remove_many(GST_BIN(self->pipeline), peer->queue, peer->webrtc, NULL);
+  g_object_unref(peer->connection);
+  delete peer;
+  return G_SOURCE_REMOVE;
+}
+
+gboolean WebRtcServer::send_cb(gpointer user_data) {
+  auto message = static_cast<PendingMessage *>(user_data);
+  if (soup_websocket_connection_get_state(message->connection) == SOUP_WEBSOCKET_STATE_OPEN)
+    soup_websocket_connection_send_text(message->connection, message->text);
+  g_object_unref(message->connection);
+  g_free(message->text);
+  delete message;
+  return G_SOURCE_REMOVE;
+}
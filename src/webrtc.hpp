@@ -0,0 +1,62 @@
+#pragma once
+#include <gst/gst.h>
+#include <libsoup/soup.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Serves browser viewers over WebRTC. Frames from the capture tee are decoded and encoded to VP8 once, the encoded
+// RTP packets are then shared by every peer through a second tee, so a new viewer only costs a queue and a webrtcbin.
+// Signalling is a small JSON protocol over a WebSocket at /ws, a viewer page is served at /.
+class WebRtcServer {
+public:
+  int port = 0;
+  std::string stunServer;
+
+  ~WebRtcServer();
+  int init(GstElement *pipeline, GstElement *videoTee);
+  bool start();
+  size_t peerCount();
+
+private:
+  struct Peer {
+    WebRtcServer *server;
+    SoupWebsocketConnection *connection;
+    GstElement *queue;
+    GstElement *webrtc;
+    GstPad *teePad;
+  };
+
+  GstElement *pipeline = NULL;
+  // Shared encoder
+  GstElement *queue = NULL;
+  GstElement *valve = NULL;
+  GstElement *decoder = NULL;
+  GstElement *convert = NULL;
+  GstElement *encoder = NULL;
+  GstElement *pay = NULL;
+  GstElement *rtpTee = NULL;
+  // Signalling
+  SoupServer *server = NULL;
+  std::vector<Peer *> peers;
+  std::mutex peersMutex;
+
+  void addPeer(SoupWebsocketConnection *connection);
+  void removePeer(SoupWebsocketConnection *connection);
+  SoupWebsocketConnection *connectionFor(GstElement *webrtc);
+  void send(GstElement *webrtc, const gchar *type, const gchar *key, const gchar *value, gint mlineIndex = -1);
+  void handleMessage(SoupWebsocketConnection *connection, const gchar *text);
+
+  static void http_cb(SoupServer *server, SoupMessage *msg, const char *path, GHashTable *query,
+                      SoupClientContext *client, gpointer user_data);
+  static void websocket_cb(SoupServer *server, SoupWebsocketConnection *connection, const char *path,
+                           SoupClientContext *client, gpointer user_data);
+  static void message_cb(SoupWebsocketConnection *connection, gint type, GBytes *message, gpointer user_data);
+  static void closed_cb(SoupWebsocketConnection *connection, gpointer user_data);
+  static void negotiation_needed_cb(GstElement *webrtc, gpointer user_data);
+  static void offer_created_cb(GstPromise *promise, gpointer user_data);
+  static void ice_candidate_cb(GstElement *webrtc, guint mlineIndex, gchar *candidate, gpointer user_data);
+  static GstPadProbeReturn unlink_peer_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+  static gboolean remove_peer_cb(gpointer user_data);
+  static gboolean send_cb(gpointer user_data);
+};